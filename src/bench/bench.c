@@ -0,0 +1,400 @@
+/*! \file bench.c
+ *
+ * \brief Benchmarks the tracer on procedurally generated scenes
+ *
+ * \author Joe Doliner
+ *
+ * Each case writes out an xml scene of spheres (and optionally boxes, a
+ * ground plane, reflective and transparent materials, several lights and
+ * radiosity), then parses, prepares, lights and renders it and reports how
+ * long each stage took and how many rays a second were traced. A line of
+ * json per case goes to the results file so runs can be compared over time.
+ *
+ * With -m it instead times the vector operations one at a time, each on
+ * Vec3f_t a component at a time and on V4f_t a register at a time.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "../scene.h"
+#include "../engine/defs.h"
+#include "../engine/parse.h"
+#include "../engine/stats.h"
+#include "../engine/random.h"
+
+#define bench_seed	1234	/*!< seed for placing the objects, so every run gets the same scenes */
+#define bench_rex_res	256	/*!< rex resolution for the radiosity cases */
+#define micro_n		256	/*!< how many vectors the microbenchmark works through, few enough to stay in L1 */
+#define micro_reps	80000	/*!< how many times it works through them for each operation */
+
+/*! \brief a generated scene and how to render it */
+typedef struct {
+    const char		*name;		/*!< what the case is called in the results */
+    int			nSpheres;	/*!< the number of spheres */
+    int			nBoxes;		/*!< the number of boxes */
+    bool		plane;		/*!< whether there's a ground plane */
+    int			reflectEvery;	/*!< every this many objects is reflective, 0 for none */
+    int			transpEvery;	/*!< every this many objects is transparent, 0 for none */
+    int			nLights;	/*!< the number of lights */
+    int			radAccuracy;	/*!< light rays per light for radiosity, 0 for no radiosity */
+    bool		photons;	/*!< whether radiosity uses a photon map rather than rexes */
+    int			resolution;	/*!< the width and height of the frame */
+    bool		big;		/*!< only run with -a, these need a lot of time and memory */
+} Bench_Case_t;
+
+/*! \brief the suite, ordered so that peak memory only grows from case to case */
+static Bench_Case_t cases[] = {
+    /* name			spheres	boxes	plane	refl	transp	lights	rad	photons	res	big */
+    { "spheres_10",		10,	0,	true,	0,	0,	1,	0,	false,	512,	false },
+    { "spheres_100",		100,	0,	true,	0,	0,	1,	0,	false,	512,	false },
+    { "spheres_1k",		1000,	0,	true,	0,	0,	1,	0,	false,	512,	false },
+    { "spheres_1k_res128",	1000,	0,	true,	0,	0,	1,	0,	false,	128,	false },
+    { "spheres_1k_res1024",	1000,	0,	true,	0,	0,	1,	0,	false,	1024,	false },
+    { "spheres_1k_lights4",	1000,	0,	true,	0,	0,	4,	0,	false,	512,	false },
+    { "spheres_1k_lights1k",	1000,	0,	true,	0,	0,	1024,	0,	false,	512,	false },
+    { "spheres_1k_reflect",	1000,	0,	true,	1,	0,	1,	0,	false,	512,	false },
+    { "spheres_1k_transp",	1000,	0,	true,	0,	1,	1,	0,	false,	512,	false },
+    { "glass_1k",		1000,	0,	true,	1,	1,	1,	0,	false,	512,	false },
+    { "mixed_1k",		800,	200,	true,	4,	7,	2,	0,	false,	512,	false },
+    { "radiosity_100",		100,	0,	true,	0,	0,	1,	20000,	false,	512,	false },
+    { "photons_100",		100,	0,	true,	0,	0,	1,	20000,	true,	512,	false },
+    { "spheres_10k",		10000,	0,	true,	0,	0,	1,	0,	false,	512,	false },
+    { "mixed_10k",		8000,	2000,	true,	4,	7,	2,	0,	false,	512,	false },
+    { "spheres_100k",		100000,	0,	true,	0,	0,	1,	0,	false,	512,	true },
+    { "spheres_1m",		1000000, 0,	true,	0,	0,	1,	0,	false,	512,	true },
+};
+
+#define NUM_CASES	((int) (sizeof(cases) / sizeof(cases[0])))
+
+/* !Usage
+ * \brief print how to run the benchmarks and quit
+ */
+static void Usage(const char *name) {
+    fprintf(stderr, "usage: %s [-a] [-c case] [-t threads] [-o results.json] [-d dir] [-k] [-r order] [-m]\n", name);
+    fprintf(stderr, "  -a\t\talso run the cases with 100k and more objects\n");
+    fprintf(stderr, "  -c case\tonly run the named case\n");
+    fprintf(stderr, "  -t threads\tthreads to render with, by default there's one per core\n");
+    fprintf(stderr, "  -o file\tappend the results to file as json lines, bench.json by default\n");
+    fprintf(stderr, "  -d dir\twhere to write the generated scenes, . by default\n");
+    fprintf(stderr, "  -k\t\tkeep the generated scenes\n");
+    fprintf(stderr, "  -r order\ttrace pixels in rows, tiles, morton or hilbert order, tiles by default\n");
+    fprintf(stderr, "  -m\t\ttime the Vec3f_t and V4f_t vector operations instead of running cases\n");
+    exit(1);
+}
+
+/* !Write_Color
+ * \brief write an xml color
+ */
+static void Write_Color(FILE *out, const char *tag, int r, int g, int b) {
+    fprintf(out, "<%s><r>%d</r><g>%d</g><b>%d</b></%s>", tag, r, g, b, tag);
+}
+
+/* !Write_Position
+ * \brief write an xml position
+ */
+static void Write_Position(FILE *out, const char *tag, float x, float y, float z) {
+    fprintf(out, "<%s><x>%g</x><y>%g</y><z>%g</z></%s>", tag, x, y, z, tag);
+}
+
+/* !Write_Scene
+ * \brief write out the xml for a case
+ *
+ * the objects are scattered through a cube in front of the camera which
+ * grows with the number of objects, so the density of the scene stays
+ * about the same as it's scaled up.
+ */
+static bool Write_Scene(Bench_Case_t *bc, const char *traversal, const char *fname) {
+    int i, nObjects = bc->nSpheres + bc->nBoxes;
+    float side = 4.0f * cbrtf((float) nObjects);
+    Rng_t rng;
+    FILE *out = fopen(fname, "w");
+    if (!out)
+	return false;
+
+    InitRng(&rng, bench_seed, nObjects, 0, 0);
+    fprintf(out, "<?xml version=\"1.0\" encoding='UTF-8'?>\n<scene>\n");
+
+    for (i = 0; i < nObjects; i++) {
+	float x = (UniformRng(&rng) - 0.5f) * side;
+	float y = UniformRng(&rng) * side;
+	float z = -side * 0.5f - UniformRng(&rng) * side;
+	float size = 0.5f + UniformRng(&rng);
+	bool reflect = bc->reflectEvery && i % bc->reflectEvery == 0;
+	bool transp = bc->transpEvery && i % bc->transpEvery == 0;
+
+	fprintf(out, "<geometry>");
+	if (i < bc->nSpheres)
+	    fprintf(out, "<sphere><radius>%g</radius></sphere>", size);
+	else
+	    fprintf(out, "<box><corner><x>%g</x><y>%g</y><z>%g</z></corner></box>", size, size, size);
+	Write_Position(out, "translation", x, y, z);
+	fprintf(out, "<material>");
+	Write_Color(out, "diffuse_color", 60 + NextRng(&rng) % 196, 60 + NextRng(&rng) % 196, 60 + NextRng(&rng) % 196);
+	Write_Color(out, "specular_color", 255, 255, 255);
+	fprintf(out, "<reflection>%g</reflection><transparency>%g</transparency><refraction>%g</refraction>"
+		"<spec>%g</spec><glossiness>10</glossiness></material></geometry>\n",
+		reflect ? 0.6f : 0.0f, transp ? 0.7f : 0.0f, transp ? 1.3f : 1.0f, 4.0f);
+    }
+
+    if (bc->plane) {
+	fprintf(out, "<geometry><plane>");
+	Write_Position(out, "normal", 0, 1, 0);
+	Write_Position(out, "point", 0, -1, 0);
+	fprintf(out, "</plane><material>");
+	Write_Color(out, "diffuse_color", 75, 75, 235);
+	fprintf(out, "<reflection>0.1</reflection><transparency>0</transparency><refraction>1</refraction>"
+		"<spec>0</spec></material></geometry>\n");
+    }
+
+    /* the first four lights sit at the corners above the objects, any more are scattered over them with random intensities */
+    for (i = 0; i < bc->nLights; i++) {
+	fprintf(out, "<light>");
+	Write_Color(out, "color", 255, 255, 255);
+	if (i < 4) {
+	    fprintf(out, "<intensity>%g</intensity>", 1.0f);
+	    Write_Position(out, "pos", side * (i % 2 ? 1.0f : -1.0f), side * 2, side * (i / 2 % 2 ? 0.5f : -0.5f));
+	} else {
+	    float x = (UniformRng(&rng) - 0.5f) * side * 2;
+	    float y = side * (1.0f + UniformRng(&rng));
+	    float z = -side * 1.5f * UniformRng(&rng);
+	    fprintf(out, "<intensity>%g</intensity>", 0.25f + 1.5f * UniformRng(&rng));
+	    Write_Position(out, "pos", x, y, z);
+	}
+	Write_Position(out, "look_at", 0, 0, -side);
+	fprintf(out, "</light>\n");
+    }
+
+    fprintf(out, "<camera>");
+    Write_Position(out, "pos", 0, side * 0.5f, side * 0.5f);
+    Write_Position(out, "look_at", 0, side * 0.5f, -side);
+    Write_Position(out, "up", 0, 1, 0);
+    fprintf(out, "<focal_length>5</focal_length><width>10</width><height>10</height></camera>\n");
+
+    fprintf(out, "<settings>");
+    Write_Color(out, "bg_color", 20, 20, 30);
+    fprintf(out, "<radiosity>%d</radiosity><rad_accuracy>%d</rad_accuracy><rad_mode>%s</rad_mode>"
+	    "<traversal>%s</traversal></settings>\n</scene>\n",
+	    bc->radAccuracy > 0, bc->radAccuracy, bc->photons ? "photons" : "rex", traversal);
+
+    return fclose(out) == 0;
+}
+
+/* !Rays
+ * \brief how many rays have been traced since the stats were last reset
+ */
+static uint64_t Rays() {
+    return Get_Stat(STAT_PRIMARY_RAYS) + Get_Stat(STAT_SHADOW_RAYS) + Get_Stat(STAT_REFLECTION_RAYS) +
+	Get_Stat(STAT_REFRACTION_RAYS) + Get_Stat(STAT_RADIOSITY_RAYS);
+}
+
+/* !Run_Case
+ * \brief generate, trace and report on one case
+ */
+static bool Run_Case(Bench_Case_t *bc, int nThreads, const char *traversal, const char *dir, bool keep, FILE *results) {
+    char fname[4096];
+    double t, parseTime, prepareTime, radTime = 0, renderTime;
+    uint64_t radRays = 0, renderRays;
+    struct rusage usage;
+
+    snprintf(fname, sizeof(fname), "%s/bench_%s.xml", dir, bc->name);
+    if (!Write_Scene(bc, traversal, fname)) {
+	fprintf(stderr, "Error: unable to write %s\n", fname);
+	return false;
+    }
+
+    Reset_Stats();
+
+    t = GetTime();
+    Scene_t *scene = Parse_File(fname);
+    parseTime = GetTime() - t;
+    if (!keep)
+	remove(fname);
+
+    scene->settings->nThreads = nThreads;
+    t = GetTime();
+    Prepare_Scene(scene);
+    prepareTime = GetTime() - t;
+
+    if (scene->settings->radiosity) {
+	t = GetTime();
+	if (scene->settings->rad_mode == RADIOSITY_PHOTONS)
+	    Calculate_Photons(scene, scene->settings->rad_accuracy);
+	else
+	    Calculate_Rex(scene, bench_rex_res, scene->settings->rad_accuracy);
+	radTime = GetTime() - t;
+	radRays = Rays();
+    }
+
+    t = GetTime();
+    Colorf_t *render = Render_Scene(scene, bc->resolution, bc->resolution);
+    renderTime = GetTime() - t;
+    renderRays = Rays() - radRays;
+    free(render);
+
+    getrusage(RUSAGE_SELF, &usage);
+    int threads = scene->pool->nThreads;
+    Delete_Scene(scene);
+
+    printf("%-20s parse %8.3fs  prepare %8.3fs  radiosity %8.3fs  render %8.3fs  %8.3f Mrays/s  %8ld KB\n",
+	    bc->name, parseTime, prepareTime, radTime, renderTime,
+	    (radRays + renderRays) / (radTime + renderTime) * 1e-6, usage.ru_maxrss);
+
+    fprintf(results, "{\"case\": \"%s\", \"spheres\": %d, \"boxes\": %d, \"planes\": %d, \"lights\": %d, "
+	    "\"resolution\": %d, \"rad_accuracy\": %d, \"threads\": %d, \"sphere_kernel\": \"%s\", \"traversal\": \"%s\", "
+	    "\"parse_s\": %f, \"prepare_s\": %f, \"radiosity_s\": %f, \"render_s\": %f, "
+	    "\"radiosity_rays\": %llu, \"render_rays\": %llu, \"mrays_per_s\": %f, \"peak_rss_kb\": %ld}\n",
+	    bc->name, bc->nSpheres, bc->nBoxes, bc->plane ? 1 : 0, bc->nLights,
+	    bc->resolution, bc->radAccuracy, threads, Kernel_Prims(), traversal,
+	    parseTime, prepareTime, radTime, renderTime,
+	    (unsigned long long) radRays, (unsigned long long) renderRays,
+	    (radRays + renderRays) / (radTime + renderTime) * 1e-6, usage.ru_maxrss);
+    fflush(results);
+    return true;
+}
+
+/*! \brief run a statement on every vector micro_reps times and give the nanoseconds each run took */
+#define MICRO_TIME(ns, stmt) do {						\
+	double start_ = GetTime();						\
+	for (r = 0; r < micro_reps; r++)					\
+	    for (i = 0; i < micro_n; i++) {					\
+		stmt;								\
+	    }									\
+	ns = (GetTime() - start_) * 1e9 / ((double) micro_reps * micro_n);	\
+    } while (0)
+
+/* !Micro_Sum
+ * \brief add up what an operation left in the output arrays, so none of it can be thrown away
+ */
+static float Micro_Sum(Vec3f_t c[micro_n], V4f_t vc[micro_n], float d[micro_n]) {
+    int i;
+    float sum = 0;
+    for (i = 0; i < micro_n; i++)
+	sum += c[i][0] + vc[i][1] + d[i];
+    return sum;
+}
+
+/* !Micro_Vectors
+ * \brief time each vector operation on Vec3f_t and on V4f_t and print how long one takes
+ *
+ * the tracer does these a vector at a time rather than over arrays, so the
+ * loops aren't allowed to be vectorized across vectors.
+ */
+__attribute__ ((optimize ("no-tree-vectorize")))
+static void Micro_Vectors() {
+    static Vec3f_t a[micro_n], b[micro_n], c[micro_n];
+    static V4f_t va[micro_n], vb[micro_n], vc[micro_n];
+    static float d[micro_n];
+    double scalar, vector;
+    float sum = 0;
+    int i, r;
+    Rng_t rng;
+
+    InitRng(&rng, bench_seed, 0, 0, 0);
+    for (i = 0; i < micro_n; i++) {
+	RandomV3f(&rng, a[i]);
+	RandomV3f(&rng, b[i]);
+	va[i] = LoadV4f(a[i]);
+	vb[i] = LoadV4f(b[i]);
+    }
+
+    printf("%-12s %10s %10s %8s\n", "operation", "Vec3f_t ns", "V4f_t ns", "speedup");
+
+    MICRO_TIME(scalar, AddV3f(a[i], b[i], c[i]));
+    MICRO_TIME(vector, vc[i] = va[i] + vb[i]);
+    printf("%-12s %10.3f %10.3f %7.2fx\n", "add", scalar, vector, scalar / vector);
+    sum += Micro_Sum(c, vc, d);
+
+    MICRO_TIME(scalar, ScaledAddV3f(a[i], 0.5f, b[i], c[i]));
+    MICRO_TIME(vector, vc[i] = va[i] + 0.5f * vb[i]);
+    printf("%-12s %10.3f %10.3f %7.2fx\n", "scaled_add", scalar, vector, scalar / vector);
+    sum += Micro_Sum(c, vc, d);
+
+    MICRO_TIME(scalar, d[i] = DotV3f(a[i], b[i]));
+    MICRO_TIME(vector, d[i] = DotV4f(va[i], vb[i]));
+    printf("%-12s %10.3f %10.3f %7.2fx\n", "dot", scalar, vector, scalar / vector);
+    sum += Micro_Sum(c, vc, d);
+
+    MICRO_TIME(scalar, CrossV3f(a[i], b[i], c[i]));
+    MICRO_TIME(vector, vc[i] = CrossV4f(va[i], vb[i]));
+    printf("%-12s %10.3f %10.3f %7.2fx\n", "cross", scalar, vector, scalar / vector);
+    sum += Micro_Sum(c, vc, d);
+
+    MICRO_TIME(scalar, ReflectV3f(a[i], b[i], c[i]));
+    MICRO_TIME(vector, vc[i] = ReflectV4f(va[i], vb[i]));
+    printf("%-12s %10.3f %10.3f %7.2fx\n", "reflect", scalar, vector, scalar / vector);
+    sum += Micro_Sum(c, vc, d);
+
+    MICRO_TIME(scalar, CopyV3f(a[i], c[i]); d[i] = NormalizeV3f(c[i]));
+    MICRO_TIME(vector, vc[i] = va[i]; d[i] = NormalizeV4f(&vc[i]));
+    printf("%-12s %10.3f %10.3f %7.2fx\n", "normalize", scalar, vector, scalar / vector);
+    sum += Micro_Sum(c, vc, d);
+
+    /* print the sum so the compiler has to work it out */
+    printf("(checksum %g)\n", sum);
+}
+
+int main (int argc, char *argv[]) {
+    int i, opt, nThreads = 0;
+    Traversal_t order;
+    bool all = false, keep = false, micro = false, ok = true;
+    const char *only = NULL, *resultsName = "bench.json", *dir = ".", *traversal = "tiles";
+
+    while ((opt = getopt(argc, argv, "ac:t:o:d:kr:m")) != -1) {
+	switch (opt) {
+	    case 'a':
+		all = true;
+		break;
+	    case 'c':
+		only = optarg;
+		break;
+	    case 't':
+		nThreads = atoi(optarg);
+		break;
+	    case 'o':
+		resultsName = optarg;
+		break;
+	    case 'd':
+		dir = optarg;
+		break;
+	    case 'k':
+		keep = true;
+		break;
+	    case 'r':
+		if (!Find_Traversal(optarg, &order))
+		    Usage(argv[0]);
+		traversal = optarg;
+		break;
+	    case 'm':
+		micro = true;
+		break;
+	    default:
+		Usage(argv[0]);
+	}
+    }
+
+    if (micro) {
+	Micro_Vectors();
+	return 0;
+    }
+
+    FILE *results = fopen(resultsName, "a");
+    if (!results) {
+	fprintf(stderr, "Error: unable to open %s\n", resultsName);
+	return 1;
+    }
+
+#ifdef NO_STATS
+    printf("Warning: statistics were compiled out so no rays will be counted\n");
+#endif
+
+    for (i = 0; i < NUM_CASES; i++) {
+	if (only ? strcmp(only, cases[i].name) : (cases[i].big && !all))
+	    continue;
+	ok &= Run_Case(&cases[i], nThreads, traversal, dir, keep, results);
+    }
+
+    fclose(results);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,279 @@
+/*! \file cache.c
+ *
+ * \brief Implementation of a binary cache of parsed scene files
+ *
+ * \author Joe Doliner
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cache.h"
+#include "parse.h"
+#include "defs.h"
+
+#define FNV_OFFSET	0xCBF29CE484222325ull	/*!< starting value of a 64 bit FNV-1a hash */
+#define FNV_PRIME	0x100000001B3ull	/*!< multiplier of a 64 bit FNV-1a hash */
+
+/*! \brief the start of a cache, followed by the settings, the camera, the lights and the geometry */
+typedef struct {
+    char		magic[4];	/*!< cache_magic */
+    uint32_t		version;	/*!< cache_version */
+    uint64_t		layout;		/*!< hash of the record sizes, so caches from a different build are ignored */
+    uint64_t		hash;		/*!< hash of the xml the cache was made from */
+    uint64_t		size;		/*!< size of the whole file */
+    int32_t		nGeo;		/*!< the number of geometry records */
+    int32_t		nLights;	/*!< the number of light records */
+} Cache_Header_t;
+
+/*! \brief a geometry object as it's stored in a cache */
+typedef struct {
+    Vec3f_t		scale;		/*!< scaling along the objects x,y,z coordinates */
+    Quatf_t		rot;		/*!< the rotation of the object */
+    Vec3f_t		trans;		/*!< the translation of the object */
+    int32_t		prim_type;	/*!< what type of primitive we have */
+    int32_t		hasPrimitive;	/*!< whether the xml gave the object a primitive */
+    int32_t		hasMaterial;	/*!< whether the xml gave the object a material */
+    Primitive_t		primitive;	/*!< the primitive, only the part its type uses is meaningful */
+    Material_t		material;	/*!< the material */
+} Cache_Geo_t;
+
+/* !Hash_Bytes
+ * \brief add some bytes to a 64 bit FNV-1a hash
+ */
+static uint64_t Hash_Bytes(uint64_t hash, const unsigned char *bytes, size_t n) {
+    size_t i;
+    for (i = 0; i < n; i++) {
+	hash ^= bytes[i];
+	hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/* !Hash_File
+ * \brief hash the contents of a file
+ * \return whether the file could be read
+ */
+static bool Hash_File(const char *fname, uint64_t *hash) {
+    unsigned char buffer[1 << 16];
+    size_t n;
+    FILE *in = fopen(fname, "rb");
+    if (!in)
+	return false;
+
+    *hash = FNV_OFFSET;
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0)
+	*hash = Hash_Bytes(*hash, buffer, n);
+    fclose(in);
+    return true;
+}
+
+/* !Layout
+ * \brief a fingerprint of the sizes of everything that goes in a cache
+ */
+static uint64_t Layout() {
+    uint64_t sizes[] = { sizeof(Cache_Header_t), sizeof(Settings_t), sizeof(Camera_t),
+	sizeof(Light_t), sizeof(Cache_Geo_t), sizeof(Primitive_t), sizeof(Material_t) };
+    return Hash_Bytes(FNV_OFFSET, (const unsigned char *) sizes, sizeof(sizes));
+}
+
+/* !Prim_Size
+ * \brief how many bytes are allocated for a primitive of a type
+ */
+static size_t Prim_Size(Prim_Type_t type) {
+    switch (type) {
+	case SPHERE:
+	    return sizeof(Geo_Sphere_t);
+	case BOX:
+	    return sizeof(Geo_Box_t);
+	case TORUS:
+	    return sizeof(Geo_Torus_t);
+	case PLANE:
+	    return sizeof(Geo_Plane_t);
+	default:
+	    return sizeof(Primitive_t);
+    }
+}
+
+/* !Cache_Name
+ * \brief the name of the cache for an xml file, free it when you're done
+ */
+static char *Cache_Name(const char *fname) {
+    char *name = NEWVEC(char, strlen(fname) + strlen(cache_suffix) + 1);
+    strcpy(name, fname);
+    strcat(name, cache_suffix);
+    return name;
+}
+
+/* !Load_Cache
+ * \brief read in a cached scene
+ * \param fname the cache file
+ * \param hash the hash the cache has to match, NULL to take whatever is there
+ * \return the scene, or NULL if there's no usable cache
+ */
+Scene_t *Load_Cache(const char *fname, const uint64_t *hash) {
+    int i;
+    struct stat st;
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0)
+	return NULL;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(Cache_Header_t)) {
+	close(fd);
+	return NULL;
+    }
+
+    const unsigned char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+	return NULL;
+
+    Cache_Header_t header;
+    memcpy(&header, map, sizeof(header));
+    size_t expected = sizeof(Cache_Header_t) + sizeof(Settings_t) + sizeof(Camera_t) +
+	sizeof(Light_t) * (size_t) header.nLights + sizeof(Cache_Geo_t) * (size_t) header.nGeo;
+
+    if (memcmp(header.magic, cache_magic, 4) || header.version != cache_version ||
+	    header.layout != Layout() || (hash && header.hash != *hash) ||
+	    header.nGeo < 0 || header.nLights < 0 ||
+	    header.size != (uint64_t) st.st_size || expected != header.size) {
+	munmap((void *) map, st.st_size);
+	return NULL;
+    }
+
+    Scene_t *scene = New_Scene(header.nGeo, header.nLights);
+    const unsigned char *cur = map + sizeof(Cache_Header_t);
+
+    memcpy(scene->settings, cur, sizeof(Settings_t));
+    cur += sizeof(Settings_t);
+    memcpy(scene->camera, cur, sizeof(Camera_t));
+    cur += sizeof(Camera_t);
+
+    for (i = 0; i < header.nLights; i++) {
+	scene->light[i] = NEW(Light_t);
+	memcpy(scene->light[i], cur, sizeof(Light_t));
+	cur += sizeof(Light_t);
+    }
+
+    for (i = 0; i < header.nGeo; i++) {
+	const Cache_Geo_t *rec = (const Cache_Geo_t *) cur;
+	Geometry_t *geo = NEW(Geometry_t);
+	memset(geo, 0, sizeof(Geometry_t));
+	memcpy(geo->scale, rec->scale, sizeof(Vec3f_t));
+	memcpy(geo->rot, rec->rot, sizeof(Quatf_t));
+	memcpy(geo->trans, rec->trans, sizeof(Vec3f_t));
+	geo->prim_type = rec->prim_type;
+	if (rec->hasPrimitive) {
+	    geo->primitive = (Primitive_t *) CheckMalloc(Prim_Size(geo->prim_type));
+	    memcpy(geo->primitive, &rec->primitive, Prim_Size(geo->prim_type));
+	}
+	if (rec->hasMaterial) {
+	    geo->material = NEW(Material_t);
+	    memcpy(geo->material, &rec->material, sizeof(Material_t));
+	}
+	scene->geometry[i] = geo;
+	cur += sizeof(Cache_Geo_t);
+    }
+
+    munmap((void *) map, st.st_size);
+    return scene;
+}
+
+/* !Save_Cache
+ * \brief write out a freshly parsed scene as a cache
+ * \param scene the scene, before Prepare_Scene
+ * \param fname the cache file
+ * \param hash the hash of the xml the scene was parsed from
+ * \return whether the cache was written
+ *
+ * the cache is written to a temporary file and renamed into place so a
+ * run reading it at the same time never sees half of one.
+ */
+bool Save_Cache(Scene_t *scene, const char *fname, uint64_t hash) {
+    int i;
+    bool ok = true;
+    char *tmpName = NEWVEC(char, strlen(fname) + 5);
+    strcpy(tmpName, fname);
+    strcat(tmpName, ".tmp");
+
+    FILE *out = fopen(tmpName, "wb");
+    if (!out) {
+	free(tmpName);
+	return false;
+    }
+
+    Cache_Header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, cache_magic, 4);
+    header.version = cache_version;
+    header.layout = Layout();
+    header.hash = hash;
+    header.nGeo = scene->nGeo;
+    header.nLights = scene->nLights;
+    header.size = sizeof(Cache_Header_t) + sizeof(Settings_t) + sizeof(Camera_t) +
+	sizeof(Light_t) * (size_t) scene->nLights + sizeof(Cache_Geo_t) * (size_t) scene->nGeo;
+
+    ok &= fwrite(&header, sizeof(header), 1, out) == 1;
+    ok &= fwrite(scene->settings, sizeof(Settings_t), 1, out) == 1;
+    ok &= fwrite(scene->camera, sizeof(Camera_t), 1, out) == 1;
+    for (i = 0; i < scene->nLights; i++)
+	ok &= fwrite(scene->light[i], sizeof(Light_t), 1, out) == 1;
+
+    for (i = 0; i < scene->nGeo; i++) {
+	Geometry_t *geo = scene->geometry[i];
+	Cache_Geo_t rec;
+	memset(&rec, 0, sizeof(rec));
+	memcpy(rec.scale, geo->scale, sizeof(Vec3f_t));
+	memcpy(rec.rot, geo->rot, sizeof(Quatf_t));
+	memcpy(rec.trans, geo->trans, sizeof(Vec3f_t));
+	rec.prim_type = geo->prim_type;
+	rec.hasPrimitive = geo->primitive != NULL;
+	rec.hasMaterial = geo->material != NULL;
+	if (geo->primitive)
+	    memcpy(&rec.primitive, geo->primitive, Prim_Size(geo->prim_type));
+	if (geo->material)
+	    memcpy(&rec.material, geo->material, sizeof(Material_t));
+	ok &= fwrite(&rec, sizeof(rec), 1, out) == 1;
+    }
+
+    ok &= fclose(out) == 0;
+    if (ok)
+	ok = rename(tmpName, fname) == 0;
+    if (!ok)
+	remove(tmpName);
+    free(tmpName);
+    return ok;
+}
+
+/* !Load_Scene
+ * \brief read in a scene from an xml file or its cache
+ * \param fname the xml file
+ * \param mode which of the two to read from
+ * \return the scene, or NULL if it couldn't be read
+ */
+Scene_t *Load_Scene(const char *fname, Cache_Mode_t mode) {
+    Scene_t *scene = NULL;
+    uint64_t hash;
+    char *cacheName;
+
+    if (mode == CACHE_XML)
+	return Parse_File(fname);
+
+    cacheName = Cache_Name(fname);
+    if (mode == CACHE_BINARY) {
+	scene = Load_Cache(cacheName, NULL);
+	if (!scene)
+	    fprintf(stderr, "Error: no usable scene cache in %s\n", cacheName);
+    } else if (!Hash_File(fname, &hash)) {
+	fprintf(stderr, "Error: unable to read %s\n", fname);
+    } else if (!(scene = Load_Cache(cacheName, &hash))) {
+	scene = Parse_File(fname);
+	if (scene && !Save_Cache(scene, cacheName, hash))
+	    fprintf(stderr, "Warning: unable to write scene cache %s\n", cacheName);
+    }
+
+    free(cacheName);
+    return scene;
+}
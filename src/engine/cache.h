@@ -0,0 +1,57 @@
+/*! \file cache.h
+ *
+ * \brief A binary cache of parsed scene files
+ *
+ * \author Joe Doliner
+ *
+ * Parsing a big xml scene costs a noticeable share of a render, and the
+ * same scene usually gets rendered many times. The first time a scene is
+ * loaded it's written back out next to the xml file as fixed size binary
+ * records which later runs map into memory and copy straight out of. The
+ * cache remembers a hash of the xml it came from so it's rebuilt whenever
+ * the xml changes.
+ */
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include "../scene.h"
+
+#define cache_suffix	".cache"	/*!< appended to the name of the xml file to name its cache */
+#define cache_magic	"RTSC"		/*!< the first bytes of every cache */
+#define cache_version	11		/*!< bump whenever the layout or meaning of the records changes */
+
+/*! how to load a scene */
+typedef enum {
+    CACHE_AUTO = 0,	/*!< use the cache if it matches the xml, otherwise parse the xml and rebuild it */
+    CACHE_XML,		/*!< always parse the xml and leave the cache alone */
+    CACHE_BINARY,	/*!< always use the cache, without checking it against the xml */
+    NUM_CACHE_MODES
+} Cache_Mode_t;
+
+/* !Load_Scene
+ * \brief read in a scene from an xml file or its cache
+ * \param fname the xml file
+ * \param mode which of the two to read from
+ * \return the scene, or NULL if it couldn't be read
+ */
+Scene_t *Load_Scene(const char *fname, Cache_Mode_t mode);
+
+/* !Load_Cache
+ * \brief read in a cached scene
+ * \param fname the cache file
+ * \param hash the hash the cache has to match, NULL to take whatever is there
+ * \return the scene, or NULL if there's no usable cache
+ */
+Scene_t *Load_Cache(const char *fname, const uint64_t *hash);
+
+/* !Save_Cache
+ * \brief write out a freshly parsed scene as a cache
+ * \param scene the scene, before Prepare_Scene
+ * \param fname the cache file
+ * \param hash the hash of the xml the scene was parsed from
+ * \return whether the cache was written
+ */
+bool Save_Cache(Scene_t *scene, const char *fname, uint64_t hash);
+
+#endif
@@ -6,9 +6,13 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include "image.h"
 #include "defs.h"
 #include "vector.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /* !New_Image
  * \brief allocates the structures needed for a new image
@@ -23,6 +27,52 @@ Image_t *New_Image(int width, int height, Color_t *data) {
     return image;
 }
 
+/* !Tonemap_Image
+ * \brief turn a frame of radiance into an 8 bit image, this is the only place colors get rounded
+ * \param frame the radiance of each pixel
+ * \param width the width of the frame
+ * \param height the height of the frame
+ * \param scale what to multiply the radiance by first, 1 / the number of samples summed into each pixel
+ * \param tonemap how to squeeze the radiance into 8 bits
+ *
+ * a pixel's four channels are done at once in SSE registers when we have
+ * them, rounding to nearest like lrint.
+ */
+Image_t *Tonemap_Image(Colorf_t *frame, int width, int height, float scale, Tonemap_t tonemap) {
+    int i, n = width * height;
+    Color_t *data = NEWVEC(Color_t, n);
+    bool reinhard = tonemap == TONEMAP_REINHARD;
+
+#ifdef __SSE2__
+    __m128 vScale = _mm_set1_ps(scale), zero = _mm_setzero_ps(), one = _mm_set1_ps(1), full = _mm_set1_ps(255);
+    for (i = 0; i < n; i++) {
+	__m128 c = _mm_mul_ps(_mm_loadu_ps(frame[i]), vScale);
+	if (reinhard)
+	    c = _mm_div_ps(c, _mm_add_ps(one, c));
+	c = _mm_min_ps(_mm_max_ps(c, zero), one);
+	__m128i q = _mm_cvtps_epi32(_mm_mul_ps(c, full));
+	q = _mm_packs_epi32(q, q);
+	q = _mm_packus_epi16(q, q);
+	int packed = _mm_cvtsi128_si32(q);
+	memcpy(data[i], &packed, sizeof(Color_t));
+	data[i][3] = 255;
+    }
+#else
+    for (i = 0; i < n; i++) {
+	int k;
+	for (k = 0; k < 3; k++) {
+	    float c = frame[i][k] * scale;
+	    if (reinhard)
+		c = c / (1 + c);
+	    data[i][k] = (unsigned char) lrint(Clampf(c) * 255);
+	}
+	data[i][3] = 255;
+    }
+#endif
+
+    return New_Image(width, height, data);
+}
+
 /* !Delete_Image
  * \brief free an image point and the associated data array
  */
@@ -31,13 +81,11 @@ void Delete_Image(Image_t *image) {
     free(image);
 }
 
-/* !Write_Image
- * \brief print the image out as a ppm file
+/* !Write_P3
+ * \brief print the image out as an ascii ppm
  */
-void Write_Image(Image_t *image, const char *fname) {
+static void Write_P3(Image_t *image, FILE *out) {
     int i;
-    FILE *out = fopen(fname, "wb");
-    assert(out);
     fprintf(out, "P3\n%d %d\n255\n", image->width, image->height);
     for (i = 0; i < image->width * image->height; i++) {
 	fprintf(out, "%d %d %d", image->data[i][0], image->data[i][1], image->data[i][2]);
@@ -46,5 +94,55 @@ void Write_Image(Image_t *image, const char *fname) {
 	else
 	    fprintf(out, "\t");
     }
+}
+
+/* !Write_P6
+ * \brief write the image out as a binary ppm
+ *
+ * whole rows are packed into a buffer and written about image_chunk_size
+ * bytes at a time.
+ */
+static void Write_P6(Image_t *image, FILE *out) {
+    int i, j, rowSize = 3 * image->width;
+    int rowsPerChunk = rowSize > 0 && rowSize < image_chunk_size ? image_chunk_size / rowSize : 1;
+    unsigned char *buffer = NEWVEC(unsigned char, (size_t) rowSize * rowsPerChunk);
+
+    fprintf(out, "P6\n%d %d\n255\n", image->width, image->height);
+    for (j = 0; j < image->height; j += rowsPerChunk) {
+	int nRows = image->height - j < rowsPerChunk ? image->height - j : rowsPerChunk;
+	Color_t *src = &image->data[(size_t) j * image->width];
+	unsigned char *dst = buffer;
+	for (i = 0; i < nRows * image->width; i++) {
+	    *dst++ = src[i][0];
+	    *dst++ = src[i][1];
+	    *dst++ = src[i][2];
+	}
+	if (fwrite(buffer, rowSize, nRows, out) != (size_t) nRows) {
+	    fprintf(stderr, "Error: failed writing image\n");
+	    break;
+	}
+    }
+    free(buffer);
+}
+
+/* !Write_Image
+ * \brief print the image out as a ppm file
+ * \param image the image
+ * \param fname the file to write to
+ * \param format which flavour of ppm to write
+ */
+void Write_Image(Image_t *image, const char *fname, Image_Format_t format) {
+    FILE *out = fopen(fname, "wb");
+    assert(out);
+    switch (format) {
+	case IMAGE_P3:
+	    Write_P3(image, out);
+	    break;
+	case IMAGE_P6:
+	    Write_P6(image, out);
+	    break;
+	default:
+	    assert(false);
+    }
     fclose(out);
 }
@@ -10,6 +10,22 @@
 
 #include "vector.h"
 
+/*! the formats an image can be written in */
+typedef enum {
+    IMAGE_P3 = 0,	/*!< ascii ppm, big and slow but readable */
+    IMAGE_P6,		/*!< binary ppm */
+    NUM_IMAGE_FORMATS
+} Image_Format_t;
+
+/*! the ways radiance can be squeezed into 8 bits */
+typedef enum {
+    TONEMAP_CLAMP = 0,	/*!< anything brighter than 1 is cut off */
+    TONEMAP_REINHARD,	/*!< x / (1 + x), bright areas roll off instead of burning out */
+    NUM_TONEMAPS
+} Tonemap_t;
+
+#define image_chunk_size	(1 << 20)	/*!< roughly how many bytes of a binary image to write at a time */
+
 /* \brief a representation of a ppm image */
 typedef struct {
     int		width;		/*!< the width of the image */
@@ -24,6 +40,16 @@ typedef struct {
  */
 Image_t *New_Image(int width, int height, Color_t *data);
 
+/* !Tonemap_Image
+ * \brief turn a frame of radiance into an 8 bit image, this is the only place colors get rounded
+ * \param frame the radiance of each pixel
+ * \param width the width of the frame
+ * \param height the height of the frame
+ * \param scale what to multiply the radiance by first, 1 / the number of samples summed into each pixel
+ * \param tonemap how to squeeze the radiance into 8 bits
+ */
+Image_t *Tonemap_Image(Colorf_t *frame, int width, int height, float scale, Tonemap_t tonemap);
+
 /* !Delete_Image
  * \brief free an image point and the associated data array
  */
@@ -31,7 +57,10 @@ void Delete_Image(Image_t *image);
 
 /* !Write_Image
  * \brief print the image out as a ppm file
+ * \param image the image
+ * \param fname the file to write to
+ * \param format which flavour of ppm to write
  */
-void Write_Image(Image_t *image, const char *fname);
+void Write_Image(Image_t *image, const char *fname, Image_Format_t format);
 
 #endif
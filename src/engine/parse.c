@@ -7,6 +7,7 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 #include "libxml/xmlmemory.h"
 #include "libxml/parser.h"
 #include "../scene.h"
@@ -18,13 +19,14 @@
 #include "../objects/primitives/torus.h"
 #include "parse.h"
 #include "vector.h"
-#include "string.h"
+#include <string.h>
 
 #define BAD_TAG(node) 		if (!xmlStrcmp(node->content, (const xmlChar *) "\n ") && \
 					!xmlStrcmp(node->content, (const xmlChar *) "\n")) \
     					printf("Ignoring inimplemented tag named: %s\n", node->name)
 #define GRAB_FLOAT(node) 	atof((char *)node->children->content)
 #define GRAB_INT(node)		atoi((char *)node->children->content)
+#define GRAB_STRING(node)	((const xmlChar *)node->children->content)
 
 /* !Parse_Position
  * \brief read an xml node which is a position. it must have x,y and z tags in it
@@ -65,10 +67,97 @@ void Parse_Color(xmlNodePtr color, Color_t dst) {
 }
 
 /* !Parse_Quat
- * \brief read an xml node which is a quaternion, it must have 1, i, j, k values
+ * \brief read an xml node which is a rotation, either an axis and an angle in degrees or a quaternion's x, y, z and w
  */
 void Parse_Quat(xmlNodePtr quat, Quatf_t dst) {
-    assert(0);
+    Vec3f_t axis = {0, 0, 0};
+    float angle = 0;
+    bool axisAngle = false;
+
+    dst[0] = dst[1] = dst[2] = 0;
+    dst[3] = 1;
+
+    xmlNodePtr cur;
+    for (cur = quat->children; cur; cur = cur->next) {
+	if (!xmlStrcmp(cur->name, (const xmlChar *) "axis")) {
+	    Parse_Position(cur, axis);
+	    axisAngle = true;
+	} else if (!xmlStrcmp(cur->name, (const xmlChar *) "angle")) {
+	    angle = GRAB_FLOAT(cur);
+	    axisAngle = true;
+	} else if (!xmlStrcmp(cur->name, (const xmlChar *) "x"))
+	    dst[0] = GRAB_FLOAT(cur);
+	else if (!xmlStrcmp(cur->name, (const xmlChar *) "y"))
+	    dst[1] = GRAB_FLOAT(cur);
+	else if (!xmlStrcmp(cur->name, (const xmlChar *) "z"))
+	    dst[2] = GRAB_FLOAT(cur);
+	else if (!xmlStrcmp(cur->name, (const xmlChar *) "w"))
+	    dst[3] = GRAB_FLOAT(cur);
+	else
+	    BAD_TAG(cur);
+    }
+
+    if (axisAngle) {
+	NormalizeV3f(axis);
+	FromAxisAngle(axis, angle * M_PI / 180, dst);
+    }
+    NormalizeQuatf(dst, dst);
+}
+
+/* !Parse_Accel
+ * \brief read an xml node naming an acceleration structure: none, bvh or grid
+ */
+Accel_Type_t Parse_Accel(xmlNodePtr accel) {
+    if (!xmlStrcmp(GRAB_STRING(accel), (const xmlChar *) "none"))
+	return ACCEL_NONE;
+    else if (!xmlStrcmp(GRAB_STRING(accel), (const xmlChar *) "grid"))
+	return ACCEL_GRID;
+    else if (xmlStrcmp(GRAB_STRING(accel), (const xmlChar *) "bvh"))
+	printf("Unknown acceleration structure %s, using bvh\n", GRAB_STRING(accel));
+    return ACCEL_BVH;
+}
+
+/* !Parse_Sampler
+ * \brief read an xml node naming where sample points come from: random, sobol or halton
+ */
+Sampler_Type_t Parse_Sampler(xmlNodePtr sampler) {
+    if (!xmlStrcmp(GRAB_STRING(sampler), (const xmlChar *) "random"))
+	return SAMPLER_RANDOM;
+    else if (!xmlStrcmp(GRAB_STRING(sampler), (const xmlChar *) "halton"))
+	return SAMPLER_HALTON;
+    else if (xmlStrcmp(GRAB_STRING(sampler), (const xmlChar *) "sobol"))
+	printf("Unknown sampler %s, using sobol\n", GRAB_STRING(sampler));
+    return SAMPLER_SOBOL;
+}
+
+/*! \brief the name of each traversal order in scene files, indexed by Traversal_t */
+static const char *traversal_names[NUM_TRAVERSALS] = {"rows", "tiles", "morton", "hilbert"};
+
+/* !Find_Traversal
+ * \brief look up a traversal order by the name scene files give it
+ * \param dst where to write the order, only touched if the name is known
+ * \return whether the name is one of rows, tiles, morton or hilbert
+ */
+bool Find_Traversal(const char *name, Traversal_t *dst) {
+    int i;
+    for (i = 0; i < NUM_TRAVERSALS; i++) {
+	if (!strcmp(name, traversal_names[i])) {
+	    *dst = (Traversal_t) i;
+	    return true;
+	}
+    }
+    return false;
+}
+
+/* !Parse_Traversal
+ * \brief read an xml node naming the order pixels are traced in: rows, tiles, morton or hilbert
+ */
+Traversal_t Parse_Traversal(xmlNodePtr traversal) {
+    Traversal_t order;
+    if (Find_Traversal((const char *) GRAB_STRING(traversal), &order))
+	return order;
+    printf("Unknown traversal %s, using tiles\n", GRAB_STRING(traversal));
+    return TRAVERSE_TILES;
 }
 
 /* !Parse_File
@@ -107,7 +196,9 @@ Scene_t *Parse_File(const char *fname) {
     for (cur1 = root->children; cur1; cur1 = cur1->next) {
 	if (!xmlStrcmp(cur1->name, (const xmlChar *) "geometry")) {
 	    scene->geometry[++nGeo] = NEW(Geometry_t);
-	    scene->geometry[nGeo]->diffuse_rex = NULL;
+	    memset(scene->geometry[nGeo], 0, sizeof(Geometry_t));
+	    scene->geometry[nGeo]->scale[0] = scene->geometry[nGeo]->scale[1] = scene->geometry[nGeo]->scale[2] = 1;
+	    scene->geometry[nGeo]->rot[3] = 1;
 	    for (cur2 = cur1->children; cur2; cur2 = cur2->next) {
 		if (!xmlStrcmp(cur2->name, (const xmlChar *) "sphere")) {
 		    scene->geometry[nGeo]->primitive = (Primitive_t *) NEW(Geo_Sphere_t);
@@ -120,6 +211,15 @@ Scene_t *Parse_File(const char *fname) {
 			}
 		    }
 		} else if (!xmlStrcmp(cur2->name, (const xmlChar *) "box")) {
+		    scene->geometry[nGeo]->primitive = (Primitive_t *) NEW(Geo_Box_t);
+		    scene->geometry[nGeo]->prim_type = BOX;
+		    for (cur3 = cur2->children; cur3; cur3 = cur3->next) {
+			if (!xmlStrcmp(cur3->name, (const xmlChar *) "corner")) {
+			    Parse_Position(cur3, scene->geometry[nGeo]->primitive->box.r);
+			} else {
+			    BAD_TAG(cur3);
+			}
+		    }
 		} else if (!xmlStrcmp(cur2->name, (const xmlChar *) "torus")) {
 		} else if (!xmlStrcmp(cur2->name, (const xmlChar *) "plane")) {
 		    scene->geometry[nGeo]->primitive = (Primitive_t *) NEW(Geo_Plane_t);
@@ -135,10 +235,15 @@ Scene_t *Parse_File(const char *fname) {
 		    }
 		} else if(!xmlStrcmp(cur2->name, (const xmlChar *) "translation")) {
 		    Parse_Position(cur2, scene->geometry[nGeo]->trans);
+		} else if(!xmlStrcmp(cur2->name, (const xmlChar *) "scale")) {
+		    Parse_Position(cur2, scene->geometry[nGeo]->scale);
 		} else if(!xmlStrcmp(cur2->name, (const xmlChar *) "rotation")) {
 		    Parse_Quat(cur2, scene->geometry[nGeo]->rot);
 		} else if(!xmlStrcmp(cur2->name, (const xmlChar *) "material")) {
 		    scene->geometry[nGeo]->material = NEW(Material_t);
+		    /* anything the xml leaves out is off, and light goes straight through if it's transparent */
+		    memset(scene->geometry[nGeo]->material, 0, sizeof(Material_t));
+		    scene->geometry[nGeo]->material->refraction = 1;
 		    for(cur3 = cur2->children; cur3; cur3 = cur3->next) {
 			if(!xmlStrcmp(cur3->name, (const xmlChar *) "diffuse_color")) {
 			    Parse_Color(cur3, scene->geometry[nGeo]->material->diffuse_color);
@@ -202,6 +307,40 @@ Scene_t *Parse_File(const char *fname) {
 		    scene->settings->radiosity = GRAB_INT(cur2);
 		} else if (!xmlStrcmp(cur2->name, (const xmlChar *) "rad_accuracy")) {
 		    scene->settings->rad_accuracy = GRAB_INT(cur2);
+		} else if (!xmlStrcmp(cur2->name, (const xmlChar *) "rad_mode")) {
+		    if (!xmlStrcmp(GRAB_STRING(cur2), (const xmlChar *) "photons"))
+			scene->settings->rad_mode = RADIOSITY_PHOTONS;
+		    else
+			scene->settings->rad_mode = RADIOSITY_REX;
+		} else if (!xmlStrcmp(cur2->name, (const xmlChar *) "light_samples")) {
+		    scene->settings->light_samples = GRAB_INT(cur2);
+		} else if (!xmlStrcmp(cur2->name, (const xmlChar *) "ray_cutoff")) {
+		    scene->settings->ray_cutoff = GRAB_FLOAT(cur2);
+		} else if (!xmlStrcmp(cur2->name, (const xmlChar *) "roulette")) {
+		    scene->settings->roulette = GRAB_INT(cur2);
+		} else if (!xmlStrcmp(cur2->name, (const xmlChar *) "aa_base")) {
+		    scene->settings->aa_base = GRAB_INT(cur2);
+		} else if (!xmlStrcmp(cur2->name, (const xmlChar *) "aa_max")) {
+		    scene->settings->aa_max = GRAB_INT(cur2);
+		} else if (!xmlStrcmp(cur2->name, (const xmlChar *) "aa_threshold")) {
+		    scene->settings->aa_threshold = GRAB_FLOAT(cur2);
+		} else if (!xmlStrcmp(cur2->name, (const xmlChar *) "sampler")) {
+		    scene->settings->sampler = Parse_Sampler(cur2);
+		} else if (!xmlStrcmp(cur2->name, (const xmlChar *) "traversal")) {
+		    scene->settings->traversal = Parse_Traversal(cur2);
+		} else if (!xmlStrcmp(cur2->name, (const xmlChar *) "accel")) {
+		    scene->settings->accel = Parse_Accel(cur2);
+		} else if (!xmlStrcmp(cur2->name, (const xmlChar *) "threads")) {
+		    scene->settings->nThreads = GRAB_INT(cur2);
+		} else if (!xmlStrcmp(cur2->name, (const xmlChar *) "seed")) {
+		    scene->settings->seed = strtoull((char *) GRAB_STRING(cur2), NULL, 10);
+		} else if (!xmlStrcmp(cur2->name, (const xmlChar *) "packets")) {
+		    scene->settings->packets = GRAB_INT(cur2);
+		} else if (!xmlStrcmp(cur2->name, (const xmlChar *) "rex_accumulation")) {
+		    if (!xmlStrcmp(GRAB_STRING(cur2), (const xmlChar *) "partial"))
+			scene->settings->rex_accum = REX_PARTIAL;
+		    else
+			scene->settings->rex_accum = REX_ATOMIC;
 		} else {
 		    BAD_TAG(cur2);
 		}
@@ -211,5 +350,6 @@ Scene_t *Parse_File(const char *fname) {
 	}
     }
 
+    xmlFreeDoc(doc);
     return scene;
 }
@@ -12,4 +12,11 @@
 
 Scene_t *Parse_File(const char *fname);
 
+/* !Find_Traversal
+ * \brief look up a traversal order by the name scene files give it
+ * \param dst where to write the order, only touched if the name is known
+ * \return whether the name is one of rows, tiles, morton or hilbert
+ */
+bool Find_Traversal(const char *name, Traversal_t *dst);
+
 #endif
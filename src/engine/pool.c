@@ -0,0 +1,199 @@
+/*! \file pool.c
+ *
+ * \brief Implementation of a persistent pool of worker threads with work stealing
+ *
+ * \author Joe Doliner
+ */
+
+#include "pool.h"
+#include <unistd.h>
+#include <stdio.h>
+
+/*! \brief what a thread needs to know to start working */
+typedef struct {
+    Pool_t		*pool;		/*!< the pool the thread belongs to */
+    int			worker;		/*!< the index of the thread's deque */
+} Worker_t;
+
+/* !Pop_Deque
+ * \brief take a task from the top of our own deque
+ */
+static bool Pop_Deque(Deque_t *deque, int *task) {
+    bool found = false;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->top < deque->bottom) {
+	*task = deque->top++;
+	found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+/* !Steal_Deque
+ * \brief take a task from the bottom of someone else's deque
+ */
+static bool Steal_Deque(Deque_t *deque, int *task) {
+    bool found = false;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->top < deque->bottom) {
+	*task = --deque->bottom;
+	found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+/* !Work
+ * \brief run tasks until there are none left anywhere in the pool
+ */
+static void Work(Pool_t *pool, int worker) {
+    int i, task;
+    for (;;) {
+	if (Pop_Deque(&pool->deques[worker], &task)) {
+	    pool->fn(pool->arg, task, worker);
+	    continue;
+	}
+
+	/* we're out of work, go looking for someone who isn't */
+	bool stolen = false;
+	for (i = 1; i < pool->nThreads && !stolen; i++) {
+	    if (Steal_Deque(&pool->deques[(worker + i) % pool->nThreads], &task)) {
+		pool->fn(pool->arg, task, worker);
+		stolen = true;
+	    }
+	}
+	if (!stolen)
+	    return ;
+    }
+}
+
+/* !Worker_Main
+ * \brief the loop each thread in the pool sits in
+ */
+static void *Worker_Main(void *arg) {
+    Worker_t *self = (Worker_t *) arg;
+    Pool_t *pool = self->pool;
+    int seen = 0;
+
+    for (;;) {
+	pthread_mutex_lock(&pool->lock);
+	while (pool->generation == seen && !pool->quit)
+	    pthread_cond_wait(&pool->start, &pool->lock);
+	if (pool->quit) {
+	    pthread_mutex_unlock(&pool->lock);
+	    break;
+	}
+	seen = pool->generation;
+	pthread_mutex_unlock(&pool->lock);
+
+	Work(pool, self->worker);
+
+	pthread_mutex_lock(&pool->lock);
+	if (--pool->running == 0)
+	    pthread_cond_signal(&pool->done);
+	pthread_mutex_unlock(&pool->lock);
+    }
+
+    free(self);
+    return NULL;
+}
+
+/* !New_Pool
+ * \brief start a pool of threads
+ * \param nThreads how many workers the pool should have, 0 for one per core
+ */
+Pool_t *New_Pool(int nThreads) {
+    int i;
+    Pool_t *pool = NEW(Pool_t);
+
+    if (nThreads <= 0)
+	nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nThreads <= 0)
+	nThreads = 1;
+
+    pool->nThreads = nThreads;
+    pool->threads = NEWVEC(pthread_t, nThreads);
+    pool->deques = NEWVEC(Deque_t, nThreads);
+    pool->generation = 0;
+    pool->running = 0;
+    pool->quit = false;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (i = 0; i < nThreads; i++) {
+	pthread_mutex_init(&pool->deques[i].lock, NULL);
+	pool->deques[i].top = pool->deques[i].bottom = 0;
+    }
+
+    /* the thread calling Run_Pool is worker 0 so we only need to start the rest */
+    for (i = 1; i < nThreads; i++) {
+	Worker_t *worker = NEW(Worker_t);
+	worker->pool = pool;
+	worker->worker = i;
+	if (pthread_create(&pool->threads[i], NULL, Worker_Main, worker) != 0) {
+	    fprintf(stderr, "Fatal error: unable to start thread %d\n", i);
+	    exit (1);
+	}
+    }
+
+    return pool;
+}
+
+/* !Run_Pool
+ * \brief run a job on the pool and wait for it to finish, the calling thread works on it too
+ * \param pool the pool
+ * \param nTasks how many tasks there are in the job
+ * \param fn the function to call for each task
+ * \param arg passed to fn
+ */
+void Run_Pool(Pool_t *pool, int nTasks, Task_Fn_t fn, void *arg) {
+    int i;
+
+    /* hand each worker a contiguous run of tasks, neighbouring tasks tend to cost about the same */
+    for (i = 0; i < pool->nThreads; i++) {
+	pthread_mutex_lock(&pool->deques[i].lock);
+	pool->deques[i].top = (int) ((long) nTasks * i / pool->nThreads);
+	pool->deques[i].bottom = (int) ((long) nTasks * (i + 1) / pool->nThreads);
+	pthread_mutex_unlock(&pool->deques[i].lock);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->running = pool->nThreads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    Work(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running > 0)
+	pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* !Delete_Pool
+ * \brief stop the threads in a pool and free it
+ */
+void Delete_Pool(Pool_t *pool) {
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 1; i < pool->nThreads; i++)
+	pthread_join(pool->threads[i], NULL);
+
+    for (i = 0; i < pool->nThreads; i++)
+	pthread_mutex_destroy(&pool->deques[i].lock);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->deques);
+    free(pool->threads);
+    free(pool);
+}
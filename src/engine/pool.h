@@ -0,0 +1,68 @@
+/*! \file pool.h
+ *
+ * \brief A persistent pool of worker threads with work stealing
+ *
+ * \author Joe Doliner
+ */
+
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <pthread.h>
+#include "defs.h"
+
+/*! \brief a job run by the pool, called once for every task
+ *  \param arg the argument given to Run_Pool
+ *  \param task the index of the task to run
+ *  \param worker the index of the worker running it, in [0, nThreads)
+ */
+typedef void (*Task_Fn_t)(void *arg, int task, int worker);
+
+/*! \brief the tasks a worker has left
+ *
+ * tasks are never added once a job starts, so a deque is just a range of
+ * task indices. the owner takes them from the top while thieves take from
+ * the bottom, as far away from the owner as possible.
+ */
+typedef struct {
+    pthread_mutex_t	lock;		/*!< guards top and bottom */
+    int			top;		/*!< the next task the owner will run */
+    int			bottom;		/*!< one past the last task in the deque */
+} Deque_t;
+
+/*! \brief a pool of threads */
+typedef struct {
+    int			nThreads;	/*!< the number of workers, including the thread calling Run_Pool */
+    pthread_t		*threads;	/*!< the nThreads - 1 threads we started */
+    Deque_t		*deques;	/*!< one deque of tasks per worker */
+    pthread_mutex_t	lock;		/*!< guards everything below */
+    pthread_cond_t	start;		/*!< signalled when a job is ready */
+    pthread_cond_t	done;		/*!< signalled when the last worker finishes a job */
+    int			generation;	/*!< bumped for every job so workers can tell them apart */
+    int			running;	/*!< how many of the started threads are still working on the job */
+    bool		quit;		/*!< tells the threads to exit */
+    Task_Fn_t		fn;		/*!< the current job */
+    void		*arg;		/*!< the argument to the current job */
+} Pool_t;
+
+/* !New_Pool
+ * \brief start a pool of threads
+ * \param nThreads how many workers the pool should have, 0 for one per core
+ */
+Pool_t *New_Pool(int nThreads);
+
+/* !Run_Pool
+ * \brief run a job on the pool and wait for it to finish, the calling thread works on it too
+ * \param pool the pool
+ * \param nTasks how many tasks there are in the job
+ * \param fn the function to call for each task
+ * \param arg passed to fn
+ */
+void Run_Pool(Pool_t *pool, int nTasks, Task_Fn_t fn, void *arg);
+
+/* !Delete_Pool
+ * \brief stop the threads in a pool and free it
+ */
+void Delete_Pool(Pool_t *pool);
+
+#endif
@@ -0,0 +1,99 @@
+/*! \file random.h
+ *
+ * \brief A counter based random number generator
+ *
+ * \author Joe Doliner
+ *
+ * Random numbers come from Philox4x32-10 (Salmon et al, "Parallel Random
+ * Numbers: As Easy as 1, 2, 3"), which scrambles a 128 bit counter under a
+ * 64 bit key. A stream is named by what it's being used for (a photon, a
+ * pixel sample, a bounce) rather than by the order things happen in, so the
+ * numbers a stream produces don't depend on which thread draws them or
+ * when, and there's no shared state to lock.
+ */
+
+#ifndef _RANDOM_H_
+#define _RANDOM_H_
+
+#include <stdint.h>
+
+#define PHILOX_M0	0xD2511F53u	/*!< round multiplier for the first word */
+#define PHILOX_M1	0xCD9E8D57u	/*!< round multiplier for the third word */
+#define PHILOX_W0	0x9E3779B9u	/*!< key bump for the first key word */
+#define PHILOX_W1	0xBB67AE85u	/*!< key bump for the second key word */
+#define PHILOX_ROUNDS	10		/*!< the number of rounds, 10 passes BigCrush */
+
+/*! \brief a stream of random numbers */
+typedef struct {
+    uint32_t	key[2];		/*!< the seed */
+    uint32_t	ctr[4];		/*!< names the stream, the last word counts blocks within it */
+    uint32_t	out[4];		/*!< the current block of output */
+    int		used;		/*!< how much of out has been handed out */
+} Rng_t;
+
+/*! \brief scramble a counter with Philox4x32-10
+ *  \param ctr the counter
+ *  \param key the key
+ *  \param dst the scrambled counter
+ */
+static inline void PhiloxRng (uint32_t ctr[4], uint32_t key[2], uint32_t dst[4])
+{
+    int r;
+    uint32_t x0 = ctr[0], x1 = ctr[1], x2 = ctr[2], x3 = ctr[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    for (r = 0; r < PHILOX_ROUNDS; r++) {
+	uint64_t p0 = (uint64_t) PHILOX_M0 * x0;
+	uint64_t p1 = (uint64_t) PHILOX_M1 * x2;
+	x0 = (uint32_t) (p1 >> 32) ^ x1 ^ k0;
+	x2 = (uint32_t) (p0 >> 32) ^ x3 ^ k1;
+	x1 = (uint32_t) p1;
+	x3 = (uint32_t) p0;
+	k0 += PHILOX_W0;
+	k1 += PHILOX_W1;
+    }
+    dst[0] = x0;
+    dst[1] = x1;
+    dst[2] = x2;
+    dst[3] = x3;
+}
+
+/*! \brief start a stream of random numbers
+ *  \param rng the stream
+ *  \param seed the seed for the whole run
+ *  \param a what the stream is for, e.g. a light
+ *  \param b what the stream is for, e.g. a photon from that light
+ *  \param c what the stream is for, e.g. a bounce
+ */
+static inline void InitRng (Rng_t *rng, uint64_t seed, uint32_t a, uint32_t b, uint32_t c)
+{
+    rng->key[0] = (uint32_t) seed;
+    rng->key[1] = (uint32_t) (seed >> 32);
+    rng->ctr[0] = a;
+    rng->ctr[1] = b;
+    rng->ctr[2] = c;
+    rng->ctr[3] = 0;
+    rng->used = 4;
+}
+
+/*! \brief the next 32 random bits in a stream
+ *  \param rng the stream
+ */
+static inline uint32_t NextRng (Rng_t *rng)
+{
+    if (rng->used == 4) {
+	PhiloxRng(rng->ctr, rng->key, rng->out);
+	rng->ctr[3]++;
+	rng->used = 0;
+    }
+    return rng->out[rng->used++];
+}
+
+/*! \brief a random float in [0, 1)
+ *  \param rng the stream
+ */
+static inline float UniformRng (Rng_t *rng)
+{
+    return (NextRng(rng) >> 8) * (1.0f / 16777216.0f);
+}
+
+#endif /* !_RANDOM_H_ */
@@ -0,0 +1,226 @@
+/*! \file sampler.h
+ *
+ * \brief Low discrepancy sample points for the places the tracer picks random directions and positions
+ *
+ * \author Joe Doliner
+ *
+ * Independent random numbers clump and leave gaps, so estimates made from
+ * them only settle down as one over the square root of the number of
+ * samples. The points of a low discrepancy sequence are spread out evenly
+ * in every dimension, so the same noise takes far fewer of them.
+ *
+ * A sampler hands out the coordinates of one point of a sequence, one
+ * dimension at a time. The sequence is scrambled by a seed so different
+ * lights, pixels and bounces each get a sequence of their own that's just
+ * as even:
+ *
+ * - SAMPLER_SOBOL is the Sobol sequence with hash based Owen scrambling
+ *   (Burley, "Practical Hash-based Owen Scrambling"). Only the first four
+ *   dimensions of Sobol are used, dimensions past those are padded with
+ *   more groups of four whose points are shuffled by their own seeds.
+ * - SAMPLER_HALTON is the Halton sequence with a Cranley-Patterson rotation
+ *   of each dimension, for as many dimensions as there are primes in
+ *   halton_primes.
+ * - SAMPLER_RANDOM is plain random numbers from the sampler's Rng_t, which
+ *   also fills in anything past the dimensions Halton has.
+ */
+
+#ifndef _SAMPLER_H_
+#define _SAMPLER_H_
+
+#include <stdint.h>
+#include "random.h"
+#include "vector.h"
+
+#define sampler_group		4	/*!< how many dimensions of Sobol are used before padding */
+#define halton_dims		16	/*!< how many dimensions of Halton there are */
+
+/*! the sequences sample points can come from */
+typedef enum {
+    SAMPLER_RANDOM = 0,		/*!< independent random numbers */
+    SAMPLER_SOBOL,		/*!< Owen scrambled Sobol */
+    SAMPLER_HALTON,		/*!< Halton with Cranley-Patterson rotation */
+    NUM_SAMPLERS
+} Sampler_Type_t;
+
+/*! \brief one point of a sequence, handed out a dimension at a time */
+typedef struct {
+    Sampler_Type_t	type;		/*!< which sequence the point is from */
+    uint32_t		index;		/*!< which point of the sequence it is */
+    uint32_t		seed;		/*!< scrambles the sequence */
+    int			dim;		/*!< the next dimension to hand out */
+    Rng_t		*rng;		/*!< random numbers for SAMPLER_RANDOM and dimensions Halton doesn't have */
+} Sampler_t;
+
+/*! \brief the first halton_dims primes, the bases of Halton's dimensions */
+static const uint32_t halton_primes[halton_dims] = {
+    2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53
+};
+
+/*! \brief the direction numbers of the first sampler_group dimensions of Sobol (Joe and Kuo) */
+static const uint32_t sobol_dirs[sampler_group][32] = {
+    { 0x80000000, 0x40000000, 0x20000000, 0x10000000, 0x08000000, 0x04000000, 0x02000000, 0x01000000,
+      0x00800000, 0x00400000, 0x00200000, 0x00100000, 0x00080000, 0x00040000, 0x00020000, 0x00010000,
+      0x00008000, 0x00004000, 0x00002000, 0x00001000, 0x00000800, 0x00000400, 0x00000200, 0x00000100,
+      0x00000080, 0x00000040, 0x00000020, 0x00000010, 0x00000008, 0x00000004, 0x00000002, 0x00000001 },
+    { 0x80000000, 0xc0000000, 0xa0000000, 0xf0000000, 0x88000000, 0xcc000000, 0xaa000000, 0xff000000,
+      0x80800000, 0xc0c00000, 0xa0a00000, 0xf0f00000, 0x88880000, 0xcccc0000, 0xaaaa0000, 0xffff0000,
+      0x80008000, 0xc000c000, 0xa000a000, 0xf000f000, 0x88008800, 0xcc00cc00, 0xaa00aa00, 0xff00ff00,
+      0x80808080, 0xc0c0c0c0, 0xa0a0a0a0, 0xf0f0f0f0, 0x88888888, 0xcccccccc, 0xaaaaaaaa, 0xffffffff },
+    { 0x80000000, 0xc0000000, 0x60000000, 0x90000000, 0xe8000000, 0x5c000000, 0x8e000000, 0xc5000000,
+      0x68800000, 0x9cc00000, 0xee600000, 0x55900000, 0x80680000, 0xc09c0000, 0x60ee0000, 0x90550000,
+      0xe8808000, 0x5cc0c000, 0x8e606000, 0xc5909000, 0x6868e800, 0x9c9c5c00, 0xeeee8e00, 0x5555c500,
+      0x8000e880, 0xc0005cc0, 0x60008e60, 0x9000c590, 0xe8006868, 0x5c009c9c, 0x8e00eeee, 0xc5005555 },
+    { 0x80000000, 0xc0000000, 0x20000000, 0x50000000, 0xf8000000, 0x74000000, 0xa2000000, 0x93000000,
+      0xd8800000, 0x25400000, 0x59e00000, 0xe6d00000, 0x78080000, 0xb40c0000, 0x82020000, 0xc3050000,
+      0x208f8000, 0x51474000, 0xfbea2000, 0x75d93000, 0xa0858800, 0x914e5400, 0xdbe79e00, 0x25db6d00,
+      0x58800080, 0xe54000c0, 0x79e00020, 0xb6d00050, 0x800800f8, 0xc00c0074, 0x200200a2, 0x50050093 }
+};
+
+/*! \brief mix two words into a well scattered hash
+ *  \param a the first word
+ *  \param b the second word
+ */
+static inline uint32_t HashSampler (uint32_t a, uint32_t b)
+{
+    uint32_t x = a * 0x9E3779B9u ^ b;
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+/*! \brief reverse the bits of a word */
+static inline uint32_t ReverseBits (uint32_t x)
+{
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+    x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+/*! \brief Owen scramble a word: every bit is flipped or not depending only on the bits above it
+ *  \param x the word, with its most significant bit first
+ *  \param seed which of the scrambles to use
+ */
+static inline uint32_t OwenScramble (uint32_t x, uint32_t seed)
+{
+    /* the hash only lets lower bits change higher ones, so it's run on the word backwards */
+    x = ReverseBits(x);
+    x ^= x * 0x3d20adeau;
+    x += seed;
+    x *= (seed >> 16) | 1;
+    x ^= x * 0x05526c56u;
+    x ^= x * 0x53a22864u;
+    return ReverseBits(x);
+}
+
+/*! \brief one coordinate of a point of the Sobol sequence as a fixed point fraction
+ *  \param index which point
+ *  \param dim the dimension, less than sampler_group
+ */
+static inline uint32_t SobolSampler (uint32_t index, int dim)
+{
+    uint32_t x = 0;
+    int bit;
+    for (bit = 0; index; index >>= 1, bit++)
+	if (index & 1)
+	    x ^= sobol_dirs[dim][bit];
+    return x;
+}
+
+/*! \brief the radical inverse of an index in a base, its digits mirrored about the point */
+static inline float RadicalInverse (uint32_t index, uint32_t base)
+{
+    double inv = 1.0 / base, scale = inv, x = 0;
+    while (index) {
+	x += (index % base) * scale;
+	index /= base;
+	scale *= inv;
+    }
+    return (float) x;
+}
+
+/*! \brief turn a fixed point fraction into a float in [0, 1) */
+static inline float FractionSampler (uint32_t x)
+{
+    return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+/*! \brief start handing out a point of a sequence
+ *  \param sampler the sampler
+ *  \param type the sequence
+ *  \param index which point of the sequence
+ *  \param seed scrambles the sequence, points with different seeds are independent
+ *  \param rng random numbers for SAMPLER_RANDOM and dimensions Halton doesn't have
+ */
+static inline void InitSampler (Sampler_t *sampler, Sampler_Type_t type, uint32_t index, uint32_t seed, Rng_t *rng)
+{
+    sampler->type = type;
+    sampler->index = index;
+    sampler->seed = seed;
+    sampler->dim = 0;
+    sampler->rng = rng;
+}
+
+/*! \brief the next coordinate of a sampler's point, in [0, 1)
+ *  \param sampler the sampler
+ */
+static inline float NextSampler (Sampler_t *sampler)
+{
+    int dim = sampler->dim++;
+    switch (sampler->type) {
+	case SAMPLER_SOBOL: {
+	    /* each group of dimensions takes a shuffled point of the sequence, so groups don't line up */
+	    uint32_t group = dim / sampler_group;
+	    uint32_t index = OwenScramble(sampler->index, HashSampler(sampler->seed, group));
+	    uint32_t x = SobolSampler(index, dim % sampler_group);
+	    return FractionSampler(OwenScramble(x, HashSampler(sampler->seed ^ 0x5851F42Du, dim)));
+	}
+	case SAMPLER_HALTON:
+	    if (dim < halton_dims) {
+		float x = RadicalInverse(sampler->index, halton_primes[dim]) +
+		    FractionSampler(HashSampler(sampler->seed, dim));
+		if (x >= 1.0f)
+		    x -= 1.0f;
+		return Minf(x, 0x1.fffffep-1f);
+	    }
+	    return UniformRng(sampler->rng);
+	default:
+	    return UniformRng(sampler->rng);
+    }
+}
+
+/*! \brief skip to the start of the next group of dimensions, so the next few coordinates are from the same Sobol point
+ *  \param sampler the sampler
+ */
+static inline void AlignSampler (Sampler_t *sampler)
+{
+    if (sampler->type != SAMPLER_RANDOM)
+	sampler->dim = (sampler->dim + sampler_group - 1) / sampler_group * sampler_group;
+}
+
+/*! \brief perturb a vector with a sample point, just like PerturbV3f does with random numbers
+ *  \param sampler the sampler, three dimensions are used
+ *  \param v the original vector
+ *  \param s how much to scale the peturbing vector
+ *  \param dst the destination vector
+ */
+static inline void PerturbSampleV3f (Sampler_t *sampler, Vec3f_t v, float s, Vec3f_t dst)
+{
+    int i;
+    Vec3f_t perturb;
+    AlignSampler(sampler);
+    for (i = 0; i < 3; i++) {
+	perturb[i] = NextSampler(sampler);
+	perturb[i] *= 2;
+	perturb[i] -= 1;
+    }
+    NormalizeV3f(perturb);
+    ScaledAddV3f(v, s, perturb, dst);
+}
+
+#endif /* !_SAMPLER_H_ */
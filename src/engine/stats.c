@@ -0,0 +1,159 @@
+/*! \file stats.c
+ *
+ * \brief Implementation of counters and timers for seeing where a render spends its time
+ *
+ * \author Joe Doliner
+ */
+
+#include <pthread.h>
+#include "stats.h"
+
+#ifndef NO_STATS
+/*! \brief the names of the counters, in the order of Stat_t */
+static const char *statNames[NUM_STATS] = {
+    "primary_rays", "shadow_rays", "reflection_rays", "refraction_rays", "radiosity_rays",
+    "pruned_rays", "adaptive_samples", "sphere_tests", "box_tests", "torus_tests", "plane_tests",
+    "primitive_hits", "allocations", "allocated_bytes"
+};
+
+/*! \brief the names of the timers, in the order of Timer_t */
+static const char *timerNames[NUM_TIMERS] = {
+    "parse", "radiosity", "render", "tonemap", "write"
+};
+
+/*! \brief the names of the settings, in the order of Param_t */
+static const char *paramNames[NUM_PARAMS] = {
+    "aa_base", "aa_max", "aa_threshold", "aa_budget"
+};
+#endif
+
+__thread Stats_Block_t *Stats_Local = NULL;
+
+static Stats_Block_t *blocks = NULL;	/*!< every thread's counters */
+static pthread_mutex_t blocksLock = PTHREAD_MUTEX_INITIALIZER;	/*!< guards blocks */
+static double timerStart[NUM_TIMERS];	/*!< when each running timer was started */
+static double timerTotal[NUM_TIMERS];	/*!< how long each stage has taken so far */
+static double paramValue[NUM_PARAMS];	/*!< the settings to print in the report */
+
+/* !Register_Stats
+ * \brief give the calling thread a block of counters
+ *
+ * the blocks are never freed so the counts of threads which have exited
+ * still make it into the report. this can't use CheckMalloc since
+ * CheckMalloc counts itself.
+ */
+Stats_Block_t *Register_Stats() {
+    Stats_Block_t *block = calloc(1, sizeof(Stats_Block_t));
+    if (!block) {
+	fprintf(stderr, "Fatal error: unable to allocate statistics\n");
+	exit (1);
+    }
+
+    pthread_mutex_lock(&blocksLock);
+    block->next = blocks;
+    blocks = block;
+    pthread_mutex_unlock(&blocksLock);
+
+    Stats_Local = block;
+    return block;
+}
+
+/* !Start_Timer
+ * \brief start timing a stage, stages can be timed more than once and the times add up
+ */
+void Start_Timer(Timer_t timer) {
+    timerStart[timer] = GetTime();
+}
+
+/* !Stop_Timer
+ * \brief stop timing a stage
+ */
+void Stop_Timer(Timer_t timer) {
+    timerTotal[timer] += GetTime() - timerStart[timer];
+}
+
+/* !Set_Param
+ * \brief record a setting to print in the report
+ */
+void Set_Param(Param_t param, double value) {
+    paramValue[param] = value;
+}
+
+/* !Reset_Stats
+ * \brief zero every thread's counters and every timer, no other thread may be counting
+ */
+void Reset_Stats() {
+    int i;
+    Stats_Block_t *block;
+
+    pthread_mutex_lock(&blocksLock);
+    for (block = blocks; block; block = block->next)
+	for (i = 0; i < NUM_STATS; i++)
+	    block->count[i] = 0;
+    pthread_mutex_unlock(&blocksLock);
+
+    for (i = 0; i < NUM_TIMERS; i++)
+	timerTotal[i] = 0;
+}
+
+/* !Get_Stat
+ * \brief a counter summed over every thread
+ */
+uint64_t Get_Stat(Stat_t stat) {
+    uint64_t total = 0;
+    Stats_Block_t *block;
+
+    pthread_mutex_lock(&blocksLock);
+    for (block = blocks; block; block = block->next)
+	total += block->count[stat];
+    pthread_mutex_unlock(&blocksLock);
+    return total;
+}
+
+/* !Get_Timer
+ * \brief how many seconds have been spent in a stage
+ */
+double Get_Timer(Timer_t timer) {
+    return timerTotal[timer];
+}
+
+/* !Report_Stats
+ * \brief print the counters summed over every thread and the times of each stage
+ * \param out where to print to
+ * \param format how to print it
+ */
+void Report_Stats(FILE *out, Stats_Format_t format) {
+    if (format == STATS_NONE)
+	return ;
+
+#ifdef NO_STATS
+    fprintf(out, format == STATS_JSON ? "{}\n" : "Statistics were compiled out\n");
+#else
+    int i;
+    uint64_t total[NUM_STATS];
+
+    for (i = 0; i < NUM_STATS; i++)
+	total[i] = Get_Stat(i);
+
+    if (format == STATS_JSON) {
+	fprintf(out, "{\"counters\": {");
+	for (i = 0; i < NUM_STATS; i++)
+	    fprintf(out, "%s\"%s\": %llu", i ? ", " : "", statNames[i], (unsigned long long) total[i]);
+	fprintf(out, "}, \"seconds\": {");
+	for (i = 0; i < NUM_TIMERS; i++)
+	    fprintf(out, "%s\"%s\": %f", i ? ", " : "", timerNames[i], timerTotal[i]);
+	fprintf(out, "}, \"params\": {");
+	for (i = 0; i < NUM_PARAMS; i++)
+	    fprintf(out, "%s\"%s\": %.10g", i ? ", " : "", paramNames[i], paramValue[i]);
+	fprintf(out, "}}\n");
+    } else {
+	fprintf(out, "Statistics:\n");
+	for (i = 0; i < NUM_STATS; i++)
+	    fprintf(out, "  %-20s %llu\n", statNames[i], (unsigned long long) total[i]);
+	for (i = 0; i < NUM_TIMERS; i++)
+	    fprintf(out, "  %-20s %f s\n", timerNames[i], timerTotal[i]);
+	for (i = 0; i < NUM_PARAMS; i++)
+	    fprintf(out, "  %-20s %.10g\n", paramNames[i], paramValue[i]);
+    }
+#endif
+}
@@ -0,0 +1,140 @@
+/*! \file stats.h
+ *
+ * \brief Counters and timers for seeing where a render spends its time
+ *
+ * \author Joe Doliner
+ *
+ * Every thread counts into a block of its own so bumping a counter is a
+ * plain increment with no sharing between cores, the blocks are only
+ * summed when the report is printed. Building with -DNO_STATS turns all
+ * of the macros below into nothing.
+ */
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdio.h>
+#include "defs.h"
+
+/*! the things we count */
+typedef enum {
+    STAT_PRIMARY_RAYS = 0,	/*!< rays from the camera */
+    STAT_SHADOW_RAYS,		/*!< rays from a surface to a light */
+    STAT_REFLECTION_RAYS,	/*!< reflected rays */
+    STAT_REFRACTION_RAYS,	/*!< refracted rays */
+    STAT_RADIOSITY_RAYS,	/*!< rays thrown while calculating rexes */
+    STAT_PRUNED_RAYS,		/*!< reflected and refracted rays not traced because they'd add too little */
+    STAT_ADAPTIVE_SAMPLES,	/*!< primary rays traced past a pixel's base samples because it looked noisy */
+    STAT_SPHERE_TESTS,		/*!< ray-primitive tests, these four are in the same order as Prim_Type_t */
+    STAT_BOX_TESTS,
+    STAT_TORUS_TESTS,
+    STAT_PLANE_TESTS,
+    STAT_PRIM_HITS,		/*!< ray-primitive tests which hit */
+    STAT_ALLOCS,		/*!< calls to CheckMalloc */
+    STAT_ALLOC_BYTES,		/*!< bytes asked of CheckMalloc */
+    NUM_STATS
+} Stat_t;
+
+/*! the stages we time */
+typedef enum {
+    TIMER_PARSE = 0,		/*!< reading in the scene */
+    TIMER_RADIOSITY,		/*!< calculating the rexes */
+    TIMER_RENDER,		/*!< tracing the frame */
+    TIMER_TONEMAP,		/*!< rounding the frame to 8 bits */
+    TIMER_WRITE,		/*!< writing out the image */
+    NUM_TIMERS
+} Timer_t;
+
+/*! the settings a run was made with that go in the report next to the counts */
+typedef enum {
+    PARAM_AA_BASE = 0,		/*!< samples every pixel gets */
+    PARAM_AA_MAX,		/*!< the most samples a pixel can get */
+    PARAM_AA_THRESHOLD,		/*!< the error that earns a pixel another sample */
+    PARAM_AA_BUDGET,		/*!< the most samples the frame could have taken */
+    NUM_PARAMS
+} Param_t;
+
+/*! the forms the report can be printed in */
+typedef enum {
+    STATS_NONE = 0,		/*!< don't print a report */
+    STATS_TEXT,			/*!< a table for people */
+    STATS_JSON,			/*!< a json object for scripts */
+    NUM_STATS_FORMATS
+} Stats_Format_t;
+
+/*! \brief one thread's counters */
+typedef struct Stats_Block {
+    uint64_t		count[NUM_STATS];	/*!< the counters */
+    struct Stats_Block	*next;			/*!< the next thread's block */
+} Stats_Block_t;
+
+/*! \brief the calling thread's counters, NULL until it counts something */
+extern __thread Stats_Block_t *Stats_Local;
+
+/* !Register_Stats
+ * \brief give the calling thread a block of counters
+ */
+Stats_Block_t *Register_Stats();
+
+/* !Add_Stat
+ * \brief add to one of the calling thread's counters
+ */
+static inline void Add_Stat(Stat_t stat, uint64_t n) {
+    Stats_Block_t *block = Stats_Local;
+    if (!block)
+	block = Register_Stats();
+    block->count[stat] += n;
+}
+
+/* !Start_Timer
+ * \brief start timing a stage, stages can be timed more than once and the times add up
+ */
+void Start_Timer(Timer_t timer);
+
+/* !Stop_Timer
+ * \brief stop timing a stage
+ */
+void Stop_Timer(Timer_t timer);
+
+/* !Set_Param
+ * \brief record a setting to print in the report
+ */
+void Set_Param(Param_t param, double value);
+
+/* !Reset_Stats
+ * \brief zero every thread's counters and every timer, no other thread may be counting
+ */
+void Reset_Stats();
+
+/* !Get_Stat
+ * \brief a counter summed over every thread
+ */
+uint64_t Get_Stat(Stat_t stat);
+
+/* !Get_Timer
+ * \brief how many seconds have been spent in a stage
+ */
+double Get_Timer(Timer_t timer);
+
+/* !Report_Stats
+ * \brief print the counters summed over every thread and the times of each stage
+ * \param out where to print to
+ * \param format how to print it
+ */
+void Report_Stats(FILE *out, Stats_Format_t format);
+
+#ifdef NO_STATS
+#define STAT_ADD(stat, n)	((void) 0)
+#define STAT_INC(stat)		((void) 0)
+#define TIMER_START(timer)	((void) 0)
+#define TIMER_STOP(timer)	((void) 0)
+#define SET_PARAM(param, value)	((void) 0)
+#else
+#define STAT_ADD(stat, n)	Add_Stat(stat, n)
+#define STAT_INC(stat)		Add_Stat(stat, 1)
+#define TIMER_START(timer)	Start_Timer(timer)
+#define TIMER_STOP(timer)	Stop_Timer(timer)
+#define SET_PARAM(param, value)	Set_Param(param, value)
+#endif
+
+#endif
@@ -12,6 +12,7 @@
  */
 
 #include "defs.h"
+#include "stats.h"
 #include <sys/time.h>
 #include <stdio.h>
 
@@ -31,6 +32,8 @@ double GetTime ()
 void *CheckMalloc (size_t nbytes)
 {
     void *obj = malloc(nbytes);
+    STAT_INC(STAT_ALLOCS);
+    STAT_ADD(STAT_ALLOC_BYTES, nbytes);
     if (obj == 0) {
 	fprintf(stderr, "Fatel error: unable to allocate %d bytes\n", (int)nbytes);
 	exit (1);
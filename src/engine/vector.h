@@ -16,7 +16,7 @@
 
 #include <math.h>
 #include <stdlib.h>
-#include <time.h>
+#include "random.h"
 
 /*! \brief a small value for testing if something is close to 0 */
 #define EPSILON 1e-3
@@ -25,6 +25,7 @@ typedef float		Vec2f_t[2];	//!< 2D vector (used for texture coords)
 typedef float		Vec3f_t[3];	//!< 3D vector
 typedef float		Vec4f_t[4];	//!< 4D vector
 typedef unsigned char	Color_t[4];	//!< RGBA color representation
+typedef float		Colorf_t[4];	//!< RGBA radiance, 1.0 is full intensity and brighter is fine
 
 /*! \brief a ray */
 typedef struct {
@@ -315,13 +316,14 @@ static inline char ParallelV3f (Vec3f_t u, Vec3f_t v)
 }
 
 /*! \brief make a random vector
+ *  \param rng the stream of random numbers to use
  *  \param dst the destination vector
  */
-static inline void RandomV3f (Vec3f_t dst)
+static inline void RandomV3f (Rng_t *rng, Vec3f_t dst)
 {
     int i;
     for (i = 0; i < 3; i++) {
-	dst[i] = (float)rand() / (float)RAND_MAX;
+	dst[i] = UniformRng(rng);
 	dst[i] *= 2;
 	dst[i] -= 1;
     }
@@ -330,13 +332,14 @@ static inline void RandomV3f (Vec3f_t dst)
 }
 
 /*! \brief perturb a vector
+ *  \param rng the stream of random numbers to use
  *  \param v the original vector
  *  \param s how much to scale the peturbing vector
  *  \param dst the destination vector
  */
-static inline void PerturbV3f (Vec3f_t v, float s, Vec3f_t dst) {
+static inline void PerturbV3f (Rng_t *rng, Vec3f_t v, float s, Vec3f_t dst) {
     Vec3f_t perturb;
-    RandomV3f(perturb);
+    RandomV3f(rng, perturb);
     ScaledAddV3f(v, s, perturb, dst);
 }
 
@@ -360,6 +363,101 @@ static inline void PointstoRayf (Vec3f_t p1, Vec3f_t p2, Rayf_t *dst)
     NormalizeV3f(dst->dir);
 }
 
+/*! \brief a 3D vector in a 4 lane SIMD register, the fourth lane is kept 0
+ *
+ * GCC's vector extensions compile this to SSE on x86 and NEON on ARM, the
+ * arithmetic operators work on every lane at once and a float on either side
+ * is spread across the lanes. The operations below do the same sums in the
+ * same order as their Vec3f_t versions, so they give exactly the same floats.
+ */
+typedef float		V4f_t __attribute__ ((vector_size (4 * sizeof(float))));
+typedef int		V4i_t __attribute__ ((vector_size (4 * sizeof(int))));	//!< lane numbers for SHUFFLE_V4F
+
+//! \brief pick the lanes of a V4f_t, in one shuffle instruction
+#ifdef __clang__
+#define SHUFFLE_V4F(v, a, b, c, d)	__builtin_shufflevector((v), (v), (a), (b), (c), (d))
+#else
+#define SHUFFLE_V4F(v, a, b, c, d)	__builtin_shuffle((v), (V4i_t) {(a), (b), (c), (d)})
+#endif
+
+/*! \brief a ray held in V4f_ts, which are always 16 byte aligned */
+typedef struct {
+    V4f_t	orig;			//!< the origin of the ray
+    V4f_t	dir;			//!< the direction of the ray
+} Ray4f_t;
+
+//! \brief load a 3D vector into the lanes of a V4f_t
+static inline V4f_t LoadV4f (Vec3f_t v)
+{
+    return (V4f_t) {v[0], v[1], v[2], 0};
+}
+
+//! \brief store the first three lanes of a V4f_t in a 3D vector
+static inline void StoreV4f (V4f_t v, Vec3f_t dst)
+{
+    dst[0] = v[0];
+    dst[1] = v[1];
+    dst[2] = v[2];
+}
+
+//! \brief dot product of two V4f_ts, the lanes are multiplied at once and summed like DotV3f
+static inline float DotV4f (V4f_t u, V4f_t v)
+{
+    V4f_t p = u * v;
+    return (p[0] + p[1]) + p[2];
+}
+
+//! \brief the length squared of a V4f_t
+static inline float LengthSqV4f (V4f_t v)
+{
+    return DotV4f (v, v);
+}
+
+/*! \brief normalize a V4f_t in place, like NormalizeV3f
+ *  \return the original length, or 0 if it was too short to normalize
+ */
+static inline float NormalizeV4f (V4f_t *v)
+{
+    float s = LengthSqV4f(*v);
+    if (s < EPSILON) return 0.0;
+    s = sqrtf(s);
+    *v = *v * (1.0f / s);
+    return s;
+}
+
+//! \brief cross product of two V4f_ts, the lanes are rotated so it takes two multiplies and a subtract
+static inline V4f_t CrossV4f (V4f_t u, V4f_t v)
+{
+    V4f_t u1 = SHUFFLE_V4F(u, 1, 2, 0, 3), v2 = SHUFFLE_V4F(v, 2, 0, 1, 3);
+    V4f_t u2 = SHUFFLE_V4F(u, 2, 0, 1, 3), v1 = SHUFFLE_V4F(v, 1, 2, 0, 3);
+    return u1 * v2 - u2 * v1;
+}
+
+//! \brief the absolute value of every lane of a V4f_t, by clearing the sign bits
+static inline V4f_t AbsV4f (V4f_t v)
+{
+    return (V4f_t) ((V4i_t) v & 0x7fffffff);
+}
+
+//! \brief reflect a V4f_t over a normal, like ReflectV3f
+static inline V4f_t ReflectV4f (V4f_t v, V4f_t N)
+{
+    return v - (2 * DotV4f(N, v)) * N;
+}
+
+//! \brief load a ray into V4f_ts
+static inline Ray4f_t LoadRay4f (Rayf_t *r)
+{
+    Ray4f_t dst = {LoadV4f(r->orig), LoadV4f(r->dir)};
+    return dst;
+}
+
+//! \brief the point a distance along a Ray4f_t
+static inline V4f_t RayToPoint4f (Ray4f_t *r, float t)
+{
+    return r->orig + t * r->dir;
+}
+
 //! Add two chars clamping for overflow
 //! \param c1 the first char
 //! \param c2 the second char
@@ -429,4 +527,58 @@ static inline void MultiplyColor (Color_t c1, Color_t c2, Color_t dst) {
     dst[3] = 255;
 }
 
+//! \brief turn an 8 bit color into radiance
+//! \param src the 8 bit color
+//! \param dst the radiance
+static inline void ColorToColorf (Color_t src, Colorf_t dst)
+{
+    int i;
+    for (i = 0; i < 4; i++)
+	dst[i] = src[i] * (1.0f / 255);
+}
+
+//! \brief copy a radiance
+//! \param src the source radiance
+//! \param dst the destination radiance
+static inline void CopyColorf (Colorf_t src, Colorf_t dst)
+{
+    int i;
+    for (i = 0; i < 4; i++)
+	dst[i] = src[i];
+}
+
+//! \brief scale a radiance
+//! \param c the source radiance
+//! \param s the scaling factor
+//! \param dst the destination radiance
+static inline void ScaleColorf (Colorf_t c, float s, Colorf_t dst)
+{
+    int i;
+    for (i = 0; i < 4; i++)
+	dst[i] = s * c[i];
+}
+
+//! \brief blend 2 radiances
+//! \param c1 the first radiance
+//! \param c2 the second radiance
+//! \param r the ratio
+//! \param dst the destination radiance
+static inline void BlendColorf (Colorf_t c1, Colorf_t c2, float r, Colorf_t dst)
+{
+    int i;
+    for (i = 0; i < 4; i++)
+	dst[i] = r * c1[i] + (1 - r) * c2[i];
+}
+
+//! \brief add 2 radiances, nothing is clamped until the frame is tone mapped
+//! \param c1 the first radiance
+//! \param c2 the second radiance
+//! \param dst the destination radiance
+static inline void AddColorf (Colorf_t c1, Colorf_t c2, Colorf_t dst)
+{
+    int i;
+    for (i = 0; i < 4; i++)
+	dst[i] = c1[i] + c2[i];
+}
+
 #endif /* !_VECTOR_H_ */
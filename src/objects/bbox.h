@@ -1,6 +1,6 @@
-/*! \file geometry.h
+/*! \file bbox.h
  *
- * \brief A implemention of a geometry object in a scene
+ * \brief An axis aligned bounding box
  *
  * \author Joe Doliner
  */
@@ -8,6 +8,8 @@
 #ifndef _BBOX_H
 #define _BBOX_H
 
+#include <float.h>
+#include <stdbool.h>
 #include "../engine/vector.h"
 
 /* !struct to store a bounding box
@@ -17,4 +19,84 @@ typedef struct {
     Vec3f_t	corner[2]; /* !< opposing corners of the bounding box */
 } BBox_t;
 
+/*! \brief make a bounding box that contains nothing
+ *  \param box the box to empty
+ */
+static inline void EmptyBBox (BBox_t *box)
+{
+    box->corner[0][0] = box->corner[0][1] = box->corner[0][2] = FLT_MAX;
+    box->corner[1][0] = box->corner[1][1] = box->corner[1][2] = -FLT_MAX;
+}
+
+/*! \brief grow a bounding box so that it contains a point
+ *  \param box the box to grow
+ *  \param p the point to contain
+ */
+static inline void GrowPointBBox (BBox_t *box, Vec3f_t p)
+{
+    int i;
+    for (i = 0; i < 3; i++) {
+	box->corner[0][i] = Minf(box->corner[0][i], p[i]);
+	box->corner[1][i] = Maxf(box->corner[1][i], p[i]);
+    }
+}
+
+/*! \brief grow a bounding box so that it contains another one
+ *  \param box the box to grow
+ *  \param other the box to contain
+ */
+static inline void GrowBBox (BBox_t *box, BBox_t *other)
+{
+    GrowPointBBox(box, other->corner[0]);
+    GrowPointBBox(box, other->corner[1]);
+}
+
+/*! \brief the center of a bounding box
+ *  \param box the box
+ *  \param dst the center
+ */
+static inline void CentroidBBox (BBox_t *box, Vec3f_t dst)
+{
+    LerpV3f(box->corner[0], 0.5f, box->corner[1], dst);
+}
+
+/*! \brief the surface area of a bounding box, 0 for an empty box
+ *  \param box the box
+ */
+static inline float AreaBBox (BBox_t *box)
+{
+    Vec3f_t d;
+    SubV3f(box->corner[1], box->corner[0], d);
+    if (d[0] < 0 || d[1] < 0 || d[2] < 0)
+	return 0.0f;
+    return 2 * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+}
+
+/*! \brief slab test of a ray against a bounding box
+ *  \param box the box
+ *  \param ray the ray
+ *  \param invDir the componentwise inverse of the ray direction
+ *  \param tmax the ray is only tested on [0, tmax]
+ *  \return whether the ray passes through the box
+ */
+static inline bool IntersectBBox (BBox_t *box, Rayf_t *ray, Vec3f_t invDir, float tmax)
+{
+    int i;
+    float t0 = 0, t1 = tmax;
+    for (i = 0; i < 3; i++) {
+	float tnear = (box->corner[0][i] - ray->orig[i]) * invDir[i];
+	float tfar = (box->corner[1][i] - ray->orig[i]) * invDir[i];
+	if (tnear > tfar) {
+	    float tmp = tnear;
+	    tnear = tfar;
+	    tfar = tmp;
+	}
+	t0 = Maxf(t0, tnear);
+	t1 = Minf(t1, tfar);
+	if (t0 > t1)
+	    return false;
+    }
+    return true;
+}
+
 #endif
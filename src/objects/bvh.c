@@ -0,0 +1,378 @@
+/*! \file bvh.c
+ *
+ * \brief Implementation of a bounding volume hierarchy over the geometry in a scene
+ *
+ * \author Joe Doliner
+ */
+
+#include "bvh.h"
+#include "../engine/defs.h"
+
+/*! \brief what the builder needs to know about an object */
+typedef struct {
+    BBox_t		bBox;		/*!< the bounding box of the object */
+    Vec3f_t		centroid;	/*!< the center of the bounding box */
+    Geometry_t		*geo;		/*!< the object */
+} BuildRef_t;
+
+/*! \brief a bin of centroids for the surface area heuristic */
+typedef struct {
+    BBox_t		bBox;		/*!< bounds of the objects in the bin */
+    int			count;		/*!< how many objects are in the bin */
+} Bin_t;
+
+/* !Bin_Index
+ * \brief which bin a centroid falls in along an axis
+ */
+static inline int Bin_Index(BBox_t *cBox, int axis, Vec3f_t centroid) {
+    float extent = cBox->corner[1][axis] - cBox->corner[0][axis];
+    int b = (int) (bvh_bins * (centroid[axis] - cBox->corner[0][axis]) / extent);
+    if (b >= bvh_bins)
+	b = bvh_bins - 1;
+    if (b < 0)
+	b = 0;
+    return b;
+}
+
+/* !Select_Refs
+ * \brief partially sort refs[lo, hi) by centroid along an axis so refs[k] is the one that belongs there
+ */
+static void Select_Refs(BuildRef_t *refs, int lo, int hi, int k, int axis) {
+    hi--;
+    while (lo < hi) {
+	float pivot = refs[(lo + hi) / 2].centroid[axis];
+	int i = lo, j = hi;
+	while (i <= j) {
+	    while (refs[i].centroid[axis] < pivot)
+		i++;
+	    while (refs[j].centroid[axis] > pivot)
+		j--;
+	    if (i <= j) {
+		BuildRef_t tmp = refs[i];
+		refs[i++] = refs[j];
+		refs[j--] = tmp;
+	    }
+	}
+	if (k <= j)
+	    hi = j;
+	else if (k >= i)
+	    lo = i;
+	else
+	    return ;
+    }
+}
+
+/* !Build_Node
+ * \brief recursively build the subtree over refs[first, first + n)
+ * \param depth how far below the root the subtree is
+ * \return the index of the root of the subtree
+ *
+ * a binned split only has to move one object to a side, so a bad run of
+ * them could make a tree as deep as it has objects. below bvh_median_depth
+ * every node is split in half along the widest axis of its centroids
+ * instead, which keeps the deepest leaf within bvh_stack_size - 2 for any
+ * int number of objects.
+ */
+static int Build_Node(BVH_t *bvh, BuildRef_t *refs, int first, int n, int depth) {
+    int i, axis, index = bvh->nNodes++;
+    BVHNode_t *node = &bvh->nodes[index];
+    BBox_t cBox; /* bounds of the centroids */
+
+    if (depth > bvh->depth)
+	bvh->depth = depth;
+
+    EmptyBBox(&node->bBox);
+    EmptyBBox(&cBox);
+    for (i = first; i < first + n; i++) {
+	GrowBBox(&node->bBox, &refs[i].bBox);
+	GrowPointBBox(&cBox, refs[i].centroid);
+    }
+
+    /* find the cheapest split over all three axes */
+    float bestCost = FLT_MAX, nodeArea = AreaBBox(&node->bBox);
+    int bestAxis = -1, bestSplit = 0;
+    for (axis = 0; axis < 3 && n > 1 && depth < bvh_median_depth; axis++) {
+	Bin_t bins[bvh_bins];
+	float rightArea[bvh_bins];
+	int rightCount[bvh_bins];
+
+	if (cBox.corner[1][axis] - cBox.corner[0][axis] <= 0)
+	    continue;
+
+	for (i = 0; i < bvh_bins; i++) {
+	    EmptyBBox(&bins[i].bBox);
+	    bins[i].count = 0;
+	}
+	for (i = first; i < first + n; i++) {
+	    Bin_t *bin = &bins[Bin_Index(&cBox, axis, refs[i].centroid)];
+	    GrowBBox(&bin->bBox, &refs[i].bBox);
+	    bin->count++;
+	}
+
+	/* sweep from the right to get the bounds of everything right of each split */
+	BBox_t sweep;
+	int count = 0;
+	EmptyBBox(&sweep);
+	for (i = bvh_bins - 1; i > 0; i--) {
+	    GrowBBox(&sweep, &bins[i].bBox);
+	    count += bins[i].count;
+	    rightArea[i] = AreaBBox(&sweep);
+	    rightCount[i] = count;
+	}
+
+	/* then sweep from the left evaluating each split */
+	EmptyBBox(&sweep);
+	count = 0;
+	for (i = 1; i < bvh_bins; i++) {
+	    GrowBBox(&sweep, &bins[i - 1].bBox);
+	    count += bins[i - 1].count;
+	    if (count == 0 || rightCount[i] == 0)
+		continue;
+	    float cost = bvh_trav_cost + (AreaBBox(&sweep) * count + rightArea[i] * rightCount[i]) / nodeArea;
+	    if (cost < bestCost) {
+		bestCost = cost;
+		bestAxis = axis;
+		bestSplit = i;
+	    }
+	}
+    }
+
+    if (n == 1 || (n <= bvh_leaf_size && (n <= bestCost || depth >= bvh_median_depth))) {
+	node->offset = first;
+	node->nGeo = n;
+	node->axis = 0;
+	return index;
+    }
+
+    int mid;
+    if (bestAxis >= 0) {
+	/* partition the refs around the split */
+	int lo = first, hi = first + n - 1;
+	while (lo <= hi) {
+	    if (Bin_Index(&cBox, bestAxis, refs[lo].centroid) < bestSplit) {
+		lo++;
+	    } else {
+		BuildRef_t tmp = refs[lo];
+		refs[lo] = refs[hi];
+		refs[hi--] = tmp;
+	    }
+	}
+	mid = lo;
+    } else {
+	/* too deep, or every centroid is in the same place: split them in half along the widest axis */
+	Vec3f_t extent;
+	SubV3f(cBox.corner[1], cBox.corner[0], extent);
+	bestAxis = 0;
+	if (extent[1] > extent[bestAxis])
+	    bestAxis = 1;
+	if (extent[2] > extent[bestAxis])
+	    bestAxis = 2;
+	mid = first + n / 2;
+	Select_Refs(refs, first, first + n, mid, bestAxis);
+    }
+
+    node->nGeo = 0;
+    node->axis = bestAxis;
+    Build_Node(bvh, refs, first, mid - first, depth + 1);
+    node->offset = Build_Node(bvh, refs, mid, first + n - mid, depth + 1);
+
+    return index;
+}
+
+/* !Build_BVH
+ * \brief build a hierarchy over geometry objects with a binned surface area heuristic
+ * \param geometry the objects, which must all have their bounding box calculated
+ * \param nGeo the number of objects
+ */
+BVH_t *Build_BVH(Geometry_t **geometry, int nGeo) {
+    int i;
+    BVH_t *bvh = NEW(BVH_t);
+    bvh->nNodes = 0;
+    bvh->depth = 0;
+    bvh->nGeo = nGeo;
+    bvh->nodes = NULL;
+    bvh->geometry = NEWVEC(Geometry_t *, nGeo);
+    bvh->prims = NULL;
+    bvh->runs = NULL;
+
+    if (nGeo == 0)
+	return bvh;
+
+    BuildRef_t *refs = NEWVEC(BuildRef_t, nGeo);
+    for (i = 0; i < nGeo; i++) {
+	refs[i].bBox = geometry[i]->bBox;
+	CentroidBBox(&refs[i].bBox, refs[i].centroid);
+	refs[i].geo = geometry[i];
+    }
+
+    /* a binary tree with nGeo leaves never has more than 2 * nGeo - 1 nodes */
+    bvh->nodes = NEWVEC(BVHNode_t, 2 * nGeo - 1);
+    Build_Node(bvh, refs, 0, nGeo, 0);
+    /* a traversal holds at most one pending child per level plus the two it just pushed */
+    assert(bvh->depth + 2 <= bvh_stack_size);
+
+    for (i = 0; i < nGeo; i++)
+	bvh->geometry[i] = refs[i].geo;
+    /* a leaf tests each kind of object in a loop of its own, so they're grouped by kind */
+    bvh->runs = NEWVEC(Prim_Runs_t, bvh->nNodes);
+    for (i = 0; i < bvh->nNodes; i++)
+	if (bvh->nodes[i].nGeo > 0)
+	    Sort_Prims(bvh->geometry + bvh->nodes[i].offset, bvh->nodes[i].nGeo, &bvh->runs[i]);
+    bvh->prims = Build_Prims(bvh->geometry, nGeo);
+
+    free(refs);
+    return bvh;
+}
+
+/* !Delete_BVH
+ * \brief free a hierarchy, the geometry in it is left alone
+ */
+void Delete_BVH(BVH_t *bvh) {
+    free(bvh->nodes);
+    free(bvh->geometry);
+    free(bvh->runs);
+    if (bvh->prims)
+	Delete_Prims(bvh->prims);
+    free(bvh);
+}
+
+/* !Intersect_BVH
+ * \brief find the closest intersection of a ray with the objects in a hierarchy
+ * \param ray the ray
+ * \param bvh the hierarchy
+ * \param tmax only intersections closer than this are returned
+ * \param dst where to write the t and geo of the closest hit, only touched if there is one, Attributes_Geo fills in the rest
+ * \return whether the ray hit anything
+ */
+bool Intersect_BVH(Rayf_t ray, BVH_t *bvh, float tmax, Intersection_t *dst) {
+    int i, stack[bvh_stack_size], top = 0;
+    bool dirNeg[3];
+    Vec3f_t invDir;
+    bool hit = false;
+
+    if (bvh->nNodes == 0)
+	return false;
+
+    for (i = 0; i < 3; i++) {
+	invDir[i] = 1.0f / ray.dir[i];
+	dirNeg[i] = invDir[i] < 0;
+    }
+
+    stack[top++] = 0;
+    while (top > 0) {
+	int index = stack[--top];
+	BVHNode_t *node = &bvh->nodes[index];
+
+	if (!IntersectBBox(&node->bBox, &ray, invDir, tmax))
+	    continue;
+
+	if (node->nGeo > 0) {
+	    if (Intersect_Prims(bvh->prims, node->offset, &bvh->runs[index], ray, tmax, dst)) {
+		tmax = dst->t;
+		hit = true;
+	    }
+	} else {
+	    /* push the far child first so the near one gets visited first */
+	    assert(top + 2 <= bvh_stack_size);
+	    if (dirNeg[node->axis]) {
+		stack[top++] = index + 1;
+		stack[top++] = node->offset;
+	    } else {
+		stack[top++] = node->offset;
+		stack[top++] = index + 1;
+	    }
+	}
+    }
+
+    return hit;
+}
+
+/* !Occluded_BVH
+ * \brief whether a ray hits any object in a hierarchy before tmax
+ * \param ray the ray
+ * \param bvh the hierarchy
+ * \param tmax only objects closer than this count
+ *
+ * this stops at the first object in the way rather than looking for the
+ * closest, which is all a shadow ray needs to know.
+ */
+bool Occluded_BVH(Rayf_t ray, BVH_t *bvh, float tmax) {
+    int i, stack[bvh_stack_size], top = 0;
+    bool dirNeg[3];
+    Vec3f_t invDir;
+
+    if (bvh->nNodes == 0)
+	return false;
+
+    for (i = 0; i < 3; i++) {
+	invDir[i] = 1.0f / ray.dir[i];
+	dirNeg[i] = invDir[i] < 0;
+    }
+
+    stack[top++] = 0;
+    while (top > 0) {
+	int index = stack[--top];
+	BVHNode_t *node = &bvh->nodes[index];
+
+	if (!IntersectBBox(&node->bBox, &ray, invDir, tmax))
+	    continue;
+
+	if (node->nGeo > 0) {
+	    if (Occluded_Prims(bvh->prims, node->offset, &bvh->runs[index], ray, tmax))
+		return true;
+	} else {
+	    assert(top + 2 <= bvh_stack_size);
+	    if (dirNeg[node->axis]) {
+		stack[top++] = index + 1;
+		stack[top++] = node->offset;
+	    } else {
+		stack[top++] = node->offset;
+		stack[top++] = index + 1;
+	    }
+	}
+    }
+
+    return false;
+}
+
+/* !IntersectPacket_BVH
+ * \brief find which object in a hierarchy each ray in a packet hits first
+ * \param packet the rays, their closest hits so far are updated
+ * \param bvh the hierarchy
+ *
+ * a node is skipped once every ray in the packet misses it, the children
+ * are visited in the order that suits the first ray.
+ */
+void IntersectPacket_BVH(Packet_t *packet, BVH_t *bvh) {
+    int i, stack[bvh_stack_size], top = 0;
+    bool dirNeg[3];
+
+    if (bvh->nNodes == 0)
+	return ;
+
+    for (i = 0; i < 3; i++)
+	dirNeg[i] = packet->invDir[i][0][0] < 0;
+
+    stack[top++] = 0;
+    while (top > 0) {
+	int index = stack[--top];
+	BVHNode_t *node = &bvh->nodes[index];
+
+	if (!IntersectBBox_Packet(packet, &node->bBox))
+	    continue;
+
+	if (node->nGeo > 0) {
+	    for (i = node->offset; i < node->offset + node->nGeo; i++)
+		IntersectGeo_Packet(packet, bvh->geometry[i]);
+	} else {
+	    assert(top + 2 <= bvh_stack_size);
+	    if (dirNeg[node->axis]) {
+		stack[top++] = index + 1;
+		stack[top++] = node->offset;
+	    } else {
+		stack[top++] = node->offset;
+		stack[top++] = index + 1;
+	    }
+	}
+    }
+}
@@ -0,0 +1,89 @@
+/*! \file bvh.h
+ *
+ * \brief A bounding volume hierarchy over the geometry in a scene
+ *
+ * \author Joe Doliner
+ */
+
+#ifndef _BVH_H_
+#define _BVH_H_
+
+#include "bbox.h"
+#include "geometry.h"
+#include "packet.h"
+#include "prims.h"
+#include "intersection.h"
+
+#define bvh_bins	16	/*!< how many bins the surface area heuristic sorts centroids into */
+#define bvh_leaf_size	sphere_lanes	/*!< the most geometry objects we'll put in a leaf, enough to fill the widest sphere kernel */
+#define bvh_trav_cost	0.125f	/*!< cost of visiting a node relative to intersecting an object */
+#define bvh_stack_size	64	/*!< the deepest a traversal can go */
+#define bvh_median_depth	(bvh_stack_size - 2 - 32)	/*!< below this depth nodes are split in half by count, so no tree outgrows the stack */
+
+/*! \brief a node of the hierarchy
+ *
+ * nodes are stored depth first, so the first child of an interior node
+ * always directly follows it in the array.
+ */
+typedef struct {
+    BBox_t		bBox;		/*!< bounds everything below this node */
+    int			offset;		/*!< leaf: the first object in BVH_t::geometry, interior: the second child */
+    short		nGeo;		/*!< how many objects are in a leaf, 0 for interior nodes */
+    short		axis;		/*!< the axis an interior node was split along */
+} BVHNode_t;
+
+/*! \brief a bounding volume hierarchy */
+typedef struct {
+    int			nNodes;		/*!< the number of nodes in the tree */
+    int			depth;		/*!< the depth of the deepest leaf, the root is at 0 */
+    BVHNode_t		*nodes;		/*!< the nodes, nodes[0] is the root */
+    int			nGeo;		/*!< the number of geometry objects in the tree */
+    Geometry_t		**geometry;	/*!< the geometry objects in leaf order */
+    Prim_Table_t	*prims;		/*!< the same objects laid out for the per type loops */
+    Prim_Runs_t		*runs;		/*!< how many objects of each kind each leaf holds, indexed like nodes and unused for interior nodes */
+} BVH_t;
+
+/* !Build_BVH
+ * \brief build a hierarchy over geometry objects with a binned surface area heuristic
+ * \param geometry the objects, which must all have their bounding box calculated
+ * \param nGeo the number of objects
+ */
+BVH_t *Build_BVH(Geometry_t **geometry, int nGeo);
+
+/* !Delete_BVH
+ * \brief free a hierarchy, the geometry in it is left alone
+ */
+void Delete_BVH(BVH_t *bvh);
+
+/* !Intersect_BVH
+ * \brief find the closest intersection of a ray with the objects in a hierarchy
+ * \param ray the ray
+ * \param bvh the hierarchy
+ * \param tmax only intersections closer than this are returned
+ * \param dst where to write the t and geo of the closest hit, only touched if there is one, Attributes_Geo fills in the rest
+ * \return whether the ray hit anything
+ */
+bool Intersect_BVH(Rayf_t ray, BVH_t *bvh, float tmax, Intersection_t *dst);
+
+/* !Occluded_BVH
+ * \brief whether a ray hits any object in a hierarchy before tmax
+ * \param ray the ray
+ * \param bvh the hierarchy
+ * \param tmax only objects closer than this count
+ *
+ * this stops at the first object in the way rather than looking for the
+ * closest, which is all a shadow ray needs to know.
+ */
+bool Occluded_BVH(Rayf_t ray, BVH_t *bvh, float tmax);
+
+/* !IntersectPacket_BVH
+ * \brief find which object in a hierarchy each ray in a packet hits first
+ * \param packet the rays, their closest hits so far are updated
+ * \param bvh the hierarchy
+ *
+ * a node is skipped once every ray in the packet misses it, the children
+ * are visited in the order that suits the first ray.
+ */
+void IntersectPacket_BVH(Packet_t *packet, BVH_t *bvh);
+
+#endif
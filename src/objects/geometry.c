@@ -5,6 +5,8 @@
  * \author Joe Doliner
  */
 
+#include <stdio.h>
+#include <float.h>
 #include "geometry.h"
 #include "primitives/sphere.h"
 #include "primitives/box.h"
@@ -13,96 +15,427 @@
 #include "../engine/defs.h"
 #include "intersection.h"
 #include "../engine/image.h"
+#include "../engine/stats.h"
+
+/* !Transform_Geo
+ * \brief work out the matrices for an object's scale, rotation and translation, leaving them NULL if it's only translated
+ */
+static void Transform_Geo(Geometry_t *geometry) {
+    int r, c;
+    Quatf_t q;
+    Mat4x4f_t rot, placed;
+
+    free(geometry->transform);
+    geometry->transform = NULL;
+    if (geometry->scale[0] == 1 && geometry->scale[1] == 1 && geometry->scale[2] == 1 &&
+	    geometry->rot[0] == 0 && geometry->rot[1] == 0 && geometry->rot[2] == 0)
+	return ;
+
+    Geo_Transform_t *transform = NEW(Geo_Transform_t);
+    NormalizeQuatf(geometry->rot, q);
+    ToRotMatrix(q, rot);
+    LoadTranslateM4f(geometry->trans[0], geometry->trans[1], geometry->trans[2], placed);
+    MultMM4f(placed, rot, placed);
+    ScaleM4f(geometry->scale[0], geometry->scale[1], geometry->scale[2], placed, transform->toWorld);
+    if (!InverseM4f(transform->toWorld, transform->toObject)) {
+	fprintf(stderr, "Error: object %d is scaled to nothing\n", geometry->id);
+	exit(1);
+    }
+
+    /* normals go through the transpose of the upper 3x3 of toObject */
+    for (r = 0; r < 3; r++)
+	for (c = 0; c < 3; c++)
+	    transform->normal[3 * c + r] = transform->toObject[4 * r + c];
+
+    geometry->transform = transform;
+}
+
+/* !Prepare_Geo
+ * \brief work out everything about an object that stays the same while it's rendered, once its fields are read in
+ */
+void Prepare_Geo(Geometry_t *geometry) {
+    Transform_Geo(geometry);
+    if (geometry->prim_type == PLANE)
+	Basis_Plane(&geometry->primitive->plane);
+}
 
 /* !Calculate_Bbox
  * \brief calculates and sets the bounding box of a geometry object in global coordinates
+ * \return false if the object is unbounded, in which case the box is left alone
  */
-void Calculate_Bbox(Geometry_t *geometry) {
+bool Calculate_Bbox(Geometry_t *geometry) {
+    int i;
+    Vec3f_t r; /* the most positive corner of the box in geometry space */
     switch (geometry->prim_type) {
 	case SPHERE:
+	    r[0] = r[1] = r[2] = geometry->primitive->sphere.radius;
 	    break;
 	case BOX:
+	    CopyV3f(geometry->primitive->box.r, r);
 	    break;
 	case TORUS:
+	    r[0] = r[1] = r[2] = geometry->primitive->torus.revRadius + geometry->primitive->torus.circRadius;
 	    break;
 	default:
-	    return ;
+	    return false;
     }
+
+    /* an affine map takes the box to one centered on the translation whose extent along each axis is the row of |toWorld| times r */
+    if (geometry->transform) {
+	Mat4x4f_t *m = &geometry->transform->toWorld;
+	Vec3f_t extent;
+	for (i = 0; i < 3; i++)
+	    extent[i] = Absf((*m)[i]) * r[0] + Absf((*m)[4 + i]) * r[1] + Absf((*m)[8 + i]) * r[2];
+	CopyV3f(extent, r);
+    }
+
+    SubV3f(geometry->trans, r, geometry->bBox.corner[0]);
+    AddV3f(geometry->trans, r, geometry->bBox.corner[1]);
+    return true;
 }
 
-/* !Intersect
- * \brief intersect a ray with a geometry object
+/* !Geospace_Ray
+ * \brief take a ray into an object's space, a translation is just a subtraction
+ *
+ * the direction isn't renormalized, so the parameter of a hit is the same
+ * in both spaces.
  */
-Intersection_t *Intersect_Geo(Rayf_t ray, Geometry_t *geometry) {
-    /* set up the ray in geometry space */
+static inline void Geospace_Ray(Rayf_t *ray, Geometry_t *geometry, Rayf_t *dst) {
+    if (geometry->transform) {
+	TransformPt3f(geometry->transform->toObject, ray->orig, dst->orig);
+	TransformVec3f(geometry->transform->toObject, ray->dir, dst->dir);
+    } else {
+	SubV3f(ray->orig, geometry->trans, dst->orig);
+	CopyV3f(ray->dir, dst->dir);
+    }
+}
+
+/* !Distance_Geo
+ * \brief how far along a ray it first hits a geometry object, nothing else about the hit is worked out
+ * \param t where to write the parameter of the hit, only touched if there is one
+ * \return whether the ray hits the object between EPSILON and tmax
+ */
+bool Distance_Geo(Rayf_t ray, Geometry_t *geometry, float tmax, float *t) {
+    float dist;
+    bool hit;
     Rayf_t geospaceRay;
-    CopyV3f(ray.dir, geospaceRay.dir);
-    CopyV3f(ray.orig, geospaceRay.orig);
-    /* Quatf_t inverseRot;
-    InverseQuatf(geometry->rot, inverseRot); */
 
-    /* RotateVecByQuatf(inverseRot, ray->orig, ray->orig);
-    RotateVecByQuatf(inverseRot, ray->dir, ray->dir); */
+    Geospace_Ray(&ray, geometry, &geospaceRay);
+
+    STAT_INC(STAT_SPHERE_TESTS + geometry->prim_type);
+    switch(geometry->prim_type) {
+	case SPHERE:
+	    hit = Distance_Sphere(&geospaceRay, &(geometry->primitive->sphere), &dist);
+	    break;
+	case BOX:
+	    hit = Distance_Box(&geospaceRay, &(geometry->primitive->box), &dist);
+	    break;
+	case TORUS:
+	    hit = Distance_Torus(&geospaceRay, &(geometry->primitive->torus), &dist);
+	    break;
+	case PLANE:
+	    hit = Distance_Plane(&geospaceRay, &(geometry->primitive->plane), &dist);
+	    break;
+	default:
+	    assert(0);
+    }
+
+    if (!hit || dist <= EPSILON || dist >= tmax)
+	return false;
+
+    STAT_INC(STAT_PRIM_HITS);
+    *t = dist;
+    return true;
+}
 
-    SubV3f(geospaceRay.orig, geometry->trans, geospaceRay.orig);
+/* !Attributes_Geo
+ * \brief fill in everything about a hit found by Distance_Geo: the point, normal, texture coordinates and material
+ *
+ * this is the expensive part of a hit, so it's only done for the one a ray ends up keeping.
+ */
+void Attributes_Geo(Rayf_t ray, Geometry_t *geometry, float t, Intersection_t *dst) {
+    /* set up the ray in geometry space */
+    Rayf_t geospaceRay;
+    Geospace_Ray(&ray, geometry, &geospaceRay);
 
-    /*now the ray is ready */
-    Intersection_t *intersection;
-    
     switch(geometry->prim_type) {
 	case SPHERE:
-	    intersection = Intersect_Sphere(&geospaceRay, &(geometry->primitive->sphere));
+	    Attributes_Sphere(&geospaceRay, &(geometry->primitive->sphere), t, dst);
 	    break;
 	case BOX:
-	    intersection = Intersect_Box(&geospaceRay, &(geometry->primitive->box));
+	    Attributes_Box(&geospaceRay, &(geometry->primitive->box), t, dst);
 	    break;
 	case TORUS:
-	    intersection = Intersect_Torus(&geospaceRay, &(geometry->primitive->torus));
+	    Attributes_Torus(&geospaceRay, &(geometry->primitive->torus), t, dst);
 	    break;
 	case PLANE:
-	    intersection = Intersect_Plane(&geospaceRay, &(geometry->primitive->plane));
+	    Attributes_Plane(&geospaceRay, &(geometry->primitive->plane), t, dst);
 	    break;
 	default:
 	    assert(0);
     }
 
-    if(intersection != NULL) {
-	AddV3f(intersection->point, geometry->trans, intersection->point);
-	intersection->material = geometry->material;
-	intersection->geo = geometry;
+    if (geometry->transform) {
+	Vec3f_t norm;
+	RayToPointf(&ray, dst->t, dst->point);
+	MultMV3f(geometry->transform->normal, dst->norm, norm);
+	NormalizeV3f(norm);
+	CopyV3f(norm, dst->norm);
+    } else {
+	AddV3f(dst->point, geometry->trans, dst->point);
     }
+    dst->material = geometry->material;
+    dst->geo = geometry;
+}
 
-    return intersection;
+/* !Intersect_Geo
+ * \brief intersect a ray with a geometry object
+ * \param dst where to write the intersection, only touched if there is a hit
+ * \return whether the ray hit the object
+ */
+bool Intersect_Geo(Rayf_t ray, Geometry_t *geometry, Intersection_t *dst) {
+    float t;
+    if (!Distance_Geo(ray, geometry, FLT_MAX, &t))
+	return false;
+    Attributes_Geo(ray, geometry, t, dst);
+    return true;
+}
+
+/* !Occludes_Geo
+ * \brief whether a geometry object is in the way of a ray before tmax, nothing else about the hit is worked out
+ */
+bool Occludes_Geo(Rayf_t ray, Geometry_t *geometry, float tmax) {
+    float t;
+    return Distance_Geo(ray, geometry, tmax, &t);
 }
 
 /* !Init_Rex
  * \brief rex pointer to the rex to initiate
  * \brief resolution the resolution of the rex
+ * \brief spec whether the rex is a spec map and needs vectors
  */
-void Init_Rex(Rex_t *rex, int resolution) {
-    int i, j;
+void Init_Rex(Rex_t *rex, int resolution, bool spec) {
+    int i, pageTexels = rex_brick_size * rex_page_size;
 
-    rex->value = NEWVEC(Color_t *, resolution);
-    rex->vec = NEWVEC(Vec3f_t *, resolution);
-    rex->nSamples = NEWVEC(int *, resolution);
+    rex->resolution = resolution;
+    rex->nPages = (resolution + pageTexels - 1) / pageTexels;
+    rex->page = NEWVEC(Rex_Page_t *, rex->nPages * rex->nPages);
+    for (i = 0; i < rex->nPages * rex->nPages; i++)
+	rex->page[i] = NULL;
+    rex->spec = spec;
+    rex->shared = false;
+}
+
+/* !Delete_Brick
+ * \brief free a brick and everything in it
+ */
+static void Delete_Brick(Rex_Brick_t *brick) {
+    free(brick->texel);
+    free(brick->vec);
+    free(brick);
+}
 
-    for (i = 0; i < resolution; i++) {
-	rex->value[i] = NEWVEC(Color_t, resolution);
-	rex->vec[i] = NEWVEC(Vec3f_t, resolution);
-	rex->nSamples[i] = NEWVEC(int, resolution);
+/* !Delete_Rex
+ * \brief free a rex and everything in it
+ */
+void Delete_Rex(Rex_t *rex) {
+    int i, j;
+    for (i = 0; i < Pages_Rex(rex); i++) {
+	if (!rex->page[i])
+	    continue;
+	for (j = 0; j < rex_page_size * rex_page_size; j++)
+	    if (rex->page[i]->brick[j])
+		Delete_Brick(rex->page[i]->brick[j]);
+	free(rex->page[i]);
     }
+    free(rex->page);
+    free(rex);
+}
+
+/* !Size_Rex
+ * \brief how many bytes a rex is using
+ */
+size_t Size_Rex(Rex_t *rex) {
+    int i, j, nTexels = rex_brick_size * rex_brick_size;
+    size_t size = sizeof(Rex_t) + sizeof(Rex_Page_t *) * Pages_Rex(rex);
+    for (i = 0; i < Pages_Rex(rex); i++) {
+	if (!rex->page[i])
+	    continue;
+	size += sizeof(Rex_Page_t);
+	for (j = 0; j < rex_page_size * rex_page_size; j++) {
+	    Rex_Brick_t *brick = rex->page[i]->brick[j];
+	    if (!brick)
+		continue;
+	    size += sizeof(Rex_Brick_t);
+	    if (brick->texel)
+		size += sizeof(Texel_t) * nTexels;
+	    if (brick->vec)
+		size += sizeof(Vec3f_t) * nTexels;
+	}
+    }
+    return size;
+}
 
+/* !Page_Index
+ * \brief the index in the directory of the page holding a texel
+ */
+static inline int Page_Index(Rex_t *rex, int i, int j) {
+    return (i >> (rex_brick_bits + rex_page_bits)) + rex->nPages * (j >> (rex_brick_bits + rex_page_bits));
+}
+
+/* !Brick_Index
+ * \brief the index within its page of the brick holding a texel
+ */
+static inline int Brick_Index(int i, int j) {
+    return ((i >> rex_brick_bits) & (rex_page_size - 1)) + rex_page_size * ((j >> rex_brick_bits) & (rex_page_size - 1));
+}
+
+/* !Texel_Index
+ * \brief the index within its brick of a texel
+ */
+static inline int Texel_Index(int i, int j) {
+    return (i & (rex_brick_size - 1)) + rex_brick_size * (j & (rex_brick_size - 1));
+}
+
+/* !New_Brick
+ * \brief an unlit brick
+ */
+static Rex_Brick_t *New_Brick(bool spec) {
+    int i, nTexels = rex_brick_size * rex_brick_size;
+    Rex_Brick_t *brick = NEW(Rex_Brick_t);
     Color_t init_color = {0, 0, 0, 255};
-    Vec3f_t init_vec = {0.0f, 0.0f, 0.0f};
 
-    for (i = 0; i < resolution; i++) {
-	for (j = 0; j < resolution; j++) {
-	    CopyColor(init_color, rex->value[i][j]);
-	    CopyV3f(init_vec, rex->vec[i][j]);
-	    rex->nSamples[i][j] = 0;
+    brick->texel = NEWVEC(Texel_t, nTexels);
+    brick->vec = spec ? NEWVEC(Vec3f_t, nTexels) : NULL;
+    for (i = 0; i < nTexels; i++) {
+	CopyColor(init_color, brick->value[i]);
+	brick->texel[i].sum[0] = brick->texel[i].sum[1] = brick->texel[i].sum[2] = 0;
+	brick->texel[i].nSamples = 0;
+	if (spec)
+	    brick->vec[i][0] = brick->vec[i][1] = brick->vec[i][2] = 0.0f;
+    }
+    return brick;
+}
+
+/* !Touch_Brick
+ * \brief the brick holding a texel, allocating it and its page if nothing has been thrown there yet
+ *
+ * when the rex is shared the pointers are installed with a compare and
+ * swap, whoever loses the race frees theirs and uses the winner's.
+ */
+static Rex_Brick_t *Touch_Brick(Rex_t *rex, int i, int j) {
+    Rex_Page_t **slot = &rex->page[Page_Index(rex, i, j)];
+    Rex_Page_t *page = rex->shared ? __atomic_load_n(slot, __ATOMIC_ACQUIRE) : *slot;
+    int k;
+
+    if (!page) {
+	page = NEW(Rex_Page_t);
+	for (k = 0; k < rex_page_size * rex_page_size; k++)
+	    page->brick[k] = NULL;
+	if (!rex->shared) {
+	    *slot = page;
+	} else {
+	    Rex_Page_t *expected = NULL;
+	    if (!__atomic_compare_exchange_n(slot, &expected, page, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		free(page);
+		page = expected;
+	    }
 	}
     }
-    rex->resolution = resolution;
+
+    Rex_Brick_t **bslot = &page->brick[Brick_Index(i, j)];
+    Rex_Brick_t *brick = rex->shared ? __atomic_load_n(bslot, __ATOMIC_ACQUIRE) : *bslot;
+
+    if (!brick) {
+	brick = New_Brick(rex->spec);
+	if (!rex->shared) {
+	    *bslot = brick;
+	} else {
+	    Rex_Brick_t *expected = NULL;
+	    if (!__atomic_compare_exchange_n(bslot, &expected, brick, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		Delete_Brick(brick);
+		brick = expected;
+	    }
+	}
+    }
+
+    return brick;
+}
+
+/* !Merge_Rex
+ * \brief add the light thrown at one page of a rex into another
+ * \param dst the rex to add to
+ * \param src the rex to add from, which must have the same resolution
+ * \param page which page to merge
+ */
+void Merge_Rex(Rex_t *dst, Rex_t *src, int page) {
+    int b, k, nTexels = rex_brick_size * rex_brick_size;
+    int pageTexels = rex_brick_size * rex_page_size;
+    assert(dst->resolution == src->resolution);
+
+    if (!src->page[page])
+	return ;
+
+    /* the texel coordinates of the corner of the page, Touch_Brick only needs any texel in a brick */
+    int pi = (page % src->nPages) * pageTexels, pj = (page / src->nPages) * pageTexels;
+    for (b = 0; b < rex_page_size * rex_page_size; b++) {
+	Rex_Brick_t *from = src->page[page]->brick[b];
+	if (!from)
+	    continue;
+	Rex_Brick_t *to = Touch_Brick(dst, pi + (b % rex_page_size) * rex_brick_size,
+		pj + (b / rex_page_size) * rex_brick_size);
+	for (k = 0; k < nTexels; k++) {
+	    to->texel[k].sum[0] += from->texel[k].sum[0];
+	    to->texel[k].sum[1] += from->texel[k].sum[1];
+	    to->texel[k].sum[2] += from->texel[k].sum[2];
+	    to->texel[k].nSamples += from->texel[k].nSamples;
+	}
+    }
+}
+
+/* !Resolve_Rex
+ * \brief average the light thrown at one page of a rex into its values
+ * \param rex the rex
+ * \param page which page to resolve
+ *
+ * the sums are freed once they're averaged, nothing can be thrown at the
+ * page after this.
+ */
+void Resolve_Rex(Rex_t *rex, int page) {
+    int b, k, c, nTexels = rex_brick_size * rex_brick_size;
+
+    if (!rex->page[page])
+	return ;
+
+    for (b = 0; b < rex_page_size * rex_page_size; b++) {
+	Rex_Brick_t *brick = rex->page[page]->brick[b];
+	if (!brick || !brick->texel)
+	    continue;
+	for (k = 0; k < nTexels; k++) {
+	    Texel_t *texel = &brick->texel[k];
+	    if (texel->nSamples == 0)
+		continue;
+	    for (c = 0; c < 3; c++)
+		brick->value[k][c] = (texel->sum[c] + texel->nSamples / 2) / texel->nSamples;
+	}
+	free(brick->texel);
+	brick->texel = NULL;
+    }
+}
+
+/* !Value_Rex
+ * \brief the resolved value of a texel, black if nothing was thrown near it
+ */
+static void Value_Rex(Rex_t *rex, int i, int j, Color_t dst) {
+    Rex_Page_t *page = rex->page[Page_Index(rex, i, j)];
+    Rex_Brick_t *brick = page ? page->brick[Brick_Index(i, j)] : NULL;
+
+    if (brick) {
+	CopyColor(brick->value[Texel_Index(i, j)], dst);
+    } else {
+	dst[0] = dst[1] = dst[2] = 0;
+	dst[3] = 255;
+    }
 }
 
 /* !CatchDiffuse_Rex
@@ -112,13 +445,11 @@ void Init_Rex(Rex_t *rex, int resolution) {
  * \param v the v parameter
  */
 void CatchDiffuse_Rex(Rex_t *rex, float u, float v, Color_t dst) {
-    int i = GetIndex_Rex(rex, u), j = GetIndex_Rex(rex, v);
-
-    CopyColor(rex->value[i][j], dst);
+    Value_Rex(rex, GetIndex_Rex(rex, u), GetIndex_Rex(rex, v), dst);
 }
 
 /* !ThrowDiffuse_Rex
- * \brief Throw a ray onto a rex
+ * \brief Throw a ray onto a rex, the rex has to be resolved before it's caught from
  * \param Rex_t *rex the rex to use
  * \param float u the u parameter
  * \param float v the v parameter
@@ -127,10 +458,19 @@ void CatchDiffuse_Rex(Rex_t *rex, float u, float v, Color_t dst) {
 void ThrowDiffuse_Rex(Rex_t *rex, float u, float v, Color_t color) {
     /* printf("Throwing ray with u = %f, v = %f\n", u, v); */
     int i = GetIndex_Rex(rex, u), j = GetIndex_Rex(rex, v);
+    Texel_t *texel = &Touch_Brick(rex, i, j)->texel[Texel_Index(i, j)];
 
-    rex->nSamples[i][j]++;
-
-    BlendColor(color, rex->value[i][j], 1.0f / rex->nSamples[i][j], rex->value[i][j]);
+    if (rex->shared) {
+	__atomic_fetch_add(&texel->sum[0], color[0], __ATOMIC_RELAXED);
+	__atomic_fetch_add(&texel->sum[1], color[1], __ATOMIC_RELAXED);
+	__atomic_fetch_add(&texel->sum[2], color[2], __ATOMIC_RELAXED);
+	__atomic_fetch_add(&texel->nSamples, 1, __ATOMIC_RELAXED);
+    } else {
+	texel->sum[0] += color[0];
+	texel->sum[1] += color[1];
+	texel->sum[2] += color[2];
+	texel->nSamples++;
+    }
 }
 
 /* !Output_Rex
@@ -143,8 +483,8 @@ void Output_Rex(Rex_t *rex, const char * fname) {
     Color_t *data = NEWVEC(Color_t, rex->resolution * rex->resolution);
     for (i = 0; i < rex->resolution; i++)
 	for (j = 0; j < rex->resolution; j++)
-	    CopyColor(rex->value[i][j], data[i + rex->resolution * j]); 
+	    Value_Rex(rex, i, j, data[i + rex->resolution * j]);
 
     Image_t *rex_image = New_Image(rex->resolution, rex->resolution, data);
-    Write_Image(rex_image, fname);
+    Write_Image(rex_image, fname, IMAGE_P6);
 }
@@ -34,30 +34,113 @@ typedef union {
     Geo_Plane_t		plane;		/*!< a plane */
 } Primitive_t;
 
-/*! radiosity texture */
+/*! running total of the light thrown at a point of a rex
+ *
+ * the total is a plain sum so it comes out the same whatever order the
+ * samples arrive in, which lets several threads throw at the same rex.
+ */
+typedef struct {
+    uint32_t	sum[3];			/*!< the sum of the r, g and b values thrown here */
+    uint32_t	nSamples;		/*!< number of samples at this point */
+} Texel_t;
+
+#define rex_brick_bits	3			/*!< a brick is 2^rex_brick_bits texels on a side */
+#define rex_brick_size	(1 << rex_brick_bits)	/*!< texels along a side of a brick */
+#define rex_page_bits	3			/*!< a page is 2^rex_page_bits bricks on a side */
+#define rex_page_size	(1 << rex_page_bits)	/*!< bricks along a side of a page */
+
+/*! a square block of texels in a rex, only allocated once light lands in it */
+typedef struct {
+    Color_t	value[rex_brick_size * rex_brick_size];	/*!< lighting values, averaged from texel by Resolve_Rex */
+    Texel_t	*texel;			/*!< the light thrown at each texel, freed once the brick is resolved */
+    Vec3f_t	*vec;			/*!< vectors for each texel, only allocated for spec maps */
+} Rex_Brick_t;
+
+/*! a square block of bricks in a rex, only allocated once light lands in it */
+typedef struct {
+    Rex_Brick_t	*brick[rex_page_size * rex_page_size];	/*!< the bricks in the page, NULL until lit */
+} Rex_Page_t;
+
+/*! radiosity texture
+ *
+ * most of an object never gets lit so a rex is stored sparsely as a two
+ * level directory of pages of bricks. both levels are allocated the first
+ * time light is thrown into them and unlit texels read back as black, so
+ * memory goes with the number of texels lit rather than the resolution.
+ */
 typedef struct {
-    Color_t	**value;		/*!< array of lighting values */
-    Vec3f_t	**vec;			/*!< array of vectors (only used for spec maps) */
-    int		**nSamples;		/*!< number of samples at each point */
+    Rex_Page_t	**page;			/*!< nPages x nPages directory of pages, NULL until lit */
+    int		nPages;			/*!< the number of pages along a side */
     int 	resolution;		/*!< the resolution of the rex */
+    bool	spec;			/*!< whether this is a spec map, which keeps a vector per texel */
+    bool	shared;			/*!< whether several threads throw at this rex at once */
 } Rex_t;
 
+/*! the placement of an object that's scaled or rotated
+ *
+ * worked out once by Transform_Geo so a ray can be taken into object space
+ * with one affine multiply rather than a quaternion inverse per test.
+ */
+typedef struct {
+    Mat4x4f_t		toWorld;	/*!< object space to world space, T * R * S: a point is scaled, then rotated, then translated */
+    Mat4x4f_t		toObject;	/*!< world space to object space, the inverse of toWorld */
+    Mat3x3f_t		normal;		/*!< takes object space normals to world space, the inverse transpose of toWorld */
+} Geo_Transform_t;
+
 /*! the struct of a geometry object */
 typedef struct {
     Vec3f_t		scale;		/*!< scaling along the objects x,y,z coordinates */
     Quatf_t		rot;		/*!< the rotation of the object */
     Vec3f_t		trans;		/*!< the translation of the object */
+    Geo_Transform_t	*transform;	/*!< the matrices for scale, rot and trans, NULL when the object is only translated */
     BBox_t		bBox;		/*!< a bounding box around the object */
     Material_t		*material; 	/*!< information about how to render the object */
     Prim_Type_t		prim_type;	/*!< what type of primitive we have */ 
     Primitive_t		*primitive;	/*!< what point to the object primitive */
     Rex_t		*diffuse_rex;	/*!< the diffuse rex */
+    int			id;		/*!< the index of the object in the scene */
 } Geometry_t;
 
-/* !Intersect
+/* !Prepare_Geo
+ * \brief work out everything about an object that stays the same while it's rendered, once its fields are read in
+ *
+ * that's the matrices for its scale, rotation and translation, left NULL if
+ * it's only translated, and for a plane the directions its texture
+ * coordinates run along.
+ */
+void Prepare_Geo(Geometry_t *geometry);
+
+/* !Calculate_Bbox
+ * \brief calculates and sets the bounding box of a geometry object in global coordinates
+ * \return false if the object is unbounded, in which case the box is left alone
+ */
+bool Calculate_Bbox(Geometry_t *geometry);
+
+/* !Distance_Geo
+ * \brief how far along a ray it first hits a geometry object, nothing else about the hit is worked out
+ * \param t where to write the parameter of the hit, only touched if there is one
+ * \return whether the ray hits the object between EPSILON and tmax
+ */
+bool Distance_Geo(Rayf_t ray, Geometry_t *geometry, float tmax, float *t);
+
+/* !Attributes_Geo
+ * \brief fill in everything about a hit found by Distance_Geo: the point, normal, texture coordinates and material
+ *
+ * this is the expensive part of a hit, so it's only done for the one a ray ends up keeping.
+ */
+void Attributes_Geo(Rayf_t ray, Geometry_t *geometry, float t, Intersection_t *dst);
+
+/* !Intersect_Geo
  * \brief intersect a ray with a geometry object
+ * \param dst where to write the intersection, only touched if there is a hit
+ * \return whether the ray hit the object
  */
-Intersection_t *Intersect_Geo(Rayf_t ray, Geometry_t *geometry);
+bool Intersect_Geo(Rayf_t ray, Geometry_t *geometry, Intersection_t *dst);
+
+/* !Occludes_Geo
+ * \brief whether a geometry object is in the way of a ray before tmax, nothing else about the hit is worked out
+ */
+bool Occludes_Geo(Rayf_t ray, Geometry_t *geometry, float tmax);
 
 /* !GetIndex_Rex
  * \brief convert a paramter into an index
@@ -75,8 +158,44 @@ static inline int GetIndex_Rex(Rex_t *rex, float p) {
 /* !Init_Rex
  * \brief rex pointer to the rex to initiate
  * \brief resolution the resolution of the rex
+ * \brief spec whether the rex is a spec map and needs vectors
+ */
+void Init_Rex(Rex_t *rex, int resolution, bool spec);
+
+/* !Delete_Rex
+ * \brief free a rex and everything in it
+ */
+void Delete_Rex(Rex_t *rex);
+
+/* !Pages_Rex
+ * \brief the number of pages in a rex, Merge_Rex and Resolve_Rex work a page at a time
+ */
+static inline int Pages_Rex(Rex_t *rex) {
+    return rex->nPages * rex->nPages;
+}
+
+/* !Size_Rex
+ * \brief how many bytes a rex is using
+ */
+size_t Size_Rex(Rex_t *rex);
+
+/* !Merge_Rex
+ * \brief add the light thrown at one page of a rex into another
+ * \param dst the rex to add to
+ * \param src the rex to add from, which must have the same resolution
+ * \param page which page to merge
  */
-void Init_Rex(Rex_t *rex, int resolution);
+void Merge_Rex(Rex_t *dst, Rex_t *src, int page);
+
+/* !Resolve_Rex
+ * \brief average the light thrown at one page of a rex into its values
+ * \param rex the rex
+ * \param page which page to resolve
+ *
+ * the sums are freed once they're averaged, nothing can be thrown at the
+ * page after this.
+ */
+void Resolve_Rex(Rex_t *rex, int page);
 
 /* !CatchSpec_Rex
  * \brief evaluate a rex for spec at parameter
@@ -108,7 +227,7 @@ void CatchDiffuse_Rex(Rex_t *rex, float u, float v, Color_t dst);
 void ThrowSpec_Rex(Rex_t *rex, float u, float v, Vec3f_t vec, Color_t color);
 
 /* !ThrowDiffuse_Rex
- * \brief Throw a ray onto a rex
+ * \brief Throw a ray onto a rex, the rex has to be resolved before it's caught from
  * \param Rex_t *rex the rex to use
  * \param float u the u parameter
  * \param float v the v parameter
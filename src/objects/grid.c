@@ -0,0 +1,239 @@
+/*! \file grid.c
+ *
+ * \brief Implementation of a uniform grid over the geometry in a scene
+ *
+ * \author Joe Doliner
+ */
+
+#include "grid.h"
+#include "../engine/defs.h"
+#include <string.h>
+
+/* !Cell_Coord
+ * \brief which cell along an axis a coordinate falls in, clamped to the grid
+ */
+static inline int Cell_Coord(Grid_t *grid, int axis, float x) {
+    int c = (int) ((x - grid->bBox.corner[0][axis]) * grid->invCellSize[axis]);
+    if (c < 0)
+	c = 0;
+    if (c >= grid->res[axis])
+	c = grid->res[axis] - 1;
+    return c;
+}
+
+/* !Cell_Index
+ * \brief the index of a cell in cellStart
+ */
+static inline int Cell_Index(Grid_t *grid, int x, int y, int z) {
+    return x + grid->res[0] * (y + grid->res[1] * z);
+}
+
+/* !Build_Grid
+ * \brief build a grid over geometry objects, the resolution is picked from how densely they're packed
+ * \param geometry the objects, which must all have their bounding box calculated
+ * \param nGeo the number of objects
+ */
+Grid_t *Build_Grid(Geometry_t **geometry, int nGeo) {
+    int i, x, y, z, axis;
+    Grid_t *grid = NEW(Grid_t);
+    grid->nGeo = nGeo;
+    grid->geometry = NEWVEC(Geometry_t *, nGeo);
+    memcpy(grid->geometry, geometry, sizeof(Geometry_t *) * nGeo);
+
+    EmptyBBox(&grid->bBox);
+    for (i = 0; i < nGeo; i++)
+	GrowBBox(&grid->bBox, &geometry[i]->bBox);
+    if (nGeo == 0)
+	grid->bBox.corner[0][0] = grid->bBox.corner[0][1] = grid->bBox.corner[0][2] =
+	    grid->bBox.corner[1][0] = grid->bBox.corner[1][1] = grid->bBox.corner[1][2] = 0.0f;
+
+    /* pad the grid a little so nothing sits right on its boundary and flat scenes still have volume */
+    Vec3f_t extent;
+    for (axis = 0; axis < 3; axis++) {
+	grid->bBox.corner[0][axis] -= EPSILON;
+	grid->bBox.corner[1][axis] += EPSILON;
+    }
+    SubV3f(grid->bBox.corner[1], grid->bBox.corner[0], extent);
+
+    /* pick the cell size so that there are about grid_density cells per object */
+    float volume = extent[0] * extent[1] * extent[2];
+    float cellsPerUnit = cbrtf(grid_density * nGeo / volume);
+    for (axis = 0; axis < 3; axis++) {
+	int res = (int) (extent[axis] * cellsPerUnit);
+	if (res < 1)
+	    res = 1;
+	if (res > grid_max_res)
+	    res = grid_max_res;
+	grid->res[axis] = res;
+	grid->cellSize[axis] = extent[axis] / res;
+	grid->invCellSize[axis] = res / extent[axis];
+    }
+
+    /* count how many objects land in each cell, then turn the counts into offsets and fill them in */
+    int nCells = grid->res[0] * grid->res[1] * grid->res[2];
+    int lo[3], hi[3];
+    grid->cellStart = NEWVEC(int, nCells + 1);
+    memset(grid->cellStart, 0, sizeof(int) * (nCells + 1));
+
+    for (i = 0; i < nGeo; i++) {
+	for (axis = 0; axis < 3; axis++) {
+	    lo[axis] = Cell_Coord(grid, axis, geometry[i]->bBox.corner[0][axis]);
+	    hi[axis] = Cell_Coord(grid, axis, geometry[i]->bBox.corner[1][axis]);
+	}
+	for (z = lo[2]; z <= hi[2]; z++)
+	    for (y = lo[1]; y <= hi[1]; y++)
+		for (x = lo[0]; x <= hi[0]; x++)
+		    grid->cellStart[Cell_Index(grid, x, y, z) + 1]++;
+    }
+
+    for (i = 0; i < nCells; i++)
+	grid->cellStart[i + 1] += grid->cellStart[i];
+
+    int *fill = NEWVEC(int, nCells);
+    memcpy(fill, grid->cellStart, sizeof(int) * nCells);
+    grid->cellGeo = NEWVEC(int, grid->cellStart[nCells] + 1);
+
+    for (i = 0; i < nGeo; i++) {
+	for (axis = 0; axis < 3; axis++) {
+	    lo[axis] = Cell_Coord(grid, axis, geometry[i]->bBox.corner[0][axis]);
+	    hi[axis] = Cell_Coord(grid, axis, geometry[i]->bBox.corner[1][axis]);
+	}
+	for (z = lo[2]; z <= hi[2]; z++)
+	    for (y = lo[1]; y <= hi[1]; y++)
+		for (x = lo[0]; x <= hi[0]; x++)
+		    grid->cellGeo[fill[Cell_Index(grid, x, y, z)]++] = i;
+    }
+
+    free(fill);
+    return grid;
+}
+
+/* !Delete_Grid
+ * \brief free a grid, the geometry in it is left alone
+ */
+void Delete_Grid(Grid_t *grid) {
+    free(grid->cellStart);
+    free(grid->cellGeo);
+    free(grid->geometry);
+    free(grid);
+}
+
+/* !Walk_Grid
+ * \brief walk a ray through a grid testing the objects in each cell it passes through
+ * \param dst where to write the t and geo of the closest hit, or NULL to stop at the first object in the way
+ *
+ * walks the cells the ray passes through with a 3D-DDA. objects spanning
+ * several cells are only tested once per ray thanks to a small mailbox of
+ * the objects we've already tried, a collision in the mailbox just means
+ * an object gets tested again.
+ */
+static bool Walk_Grid(Rayf_t ray, Grid_t *grid, float tmax, Intersection_t *dst) {
+    int i, axis;
+    int cell[3], step[3], out[3];
+    float tNext[3], tDelta[3];
+    float t0 = 0, t1 = tmax;
+    int mailbox[grid_mailbox_size];
+    bool hit = false;
+    float t;
+
+    /* clip the ray to the grid */
+    for (axis = 0; axis < 3; axis++) {
+	float invDir = 1.0f / ray.dir[axis];
+	float tnear = (grid->bBox.corner[0][axis] - ray.orig[axis]) * invDir;
+	float tfar = (grid->bBox.corner[1][axis] - ray.orig[axis]) * invDir;
+	if (tnear > tfar) {
+	    float tmp = tnear;
+	    tnear = tfar;
+	    tfar = tmp;
+	}
+	t0 = Maxf(t0, tnear);
+	t1 = Minf(t1, tfar);
+    }
+    if (t0 > t1 || grid->nGeo == 0)
+	return false;
+
+    /* set up the walk from the point where the ray enters the grid */
+    Vec3f_t entry;
+    RayToPointf(&ray, t0, entry);
+    for (axis = 0; axis < 3; axis++) {
+	cell[axis] = Cell_Coord(grid, axis, entry[axis]);
+	if (ray.dir[axis] > 0) {
+	    step[axis] = 1;
+	    out[axis] = grid->res[axis];
+	    tNext[axis] = (grid->bBox.corner[0][axis] + (cell[axis] + 1) * grid->cellSize[axis] - ray.orig[axis]) / ray.dir[axis];
+	    tDelta[axis] = grid->cellSize[axis] / ray.dir[axis];
+	} else if (ray.dir[axis] < 0) {
+	    step[axis] = -1;
+	    out[axis] = -1;
+	    tNext[axis] = (grid->bBox.corner[0][axis] + cell[axis] * grid->cellSize[axis] - ray.orig[axis]) / ray.dir[axis];
+	    tDelta[axis] = -grid->cellSize[axis] / ray.dir[axis];
+	} else {
+	    step[axis] = 0;
+	    out[axis] = -1;
+	    tNext[axis] = FLT_MAX;
+	    tDelta[axis] = FLT_MAX;
+	}
+    }
+
+    for (i = 0; i < grid_mailbox_size; i++)
+	mailbox[i] = -1;
+
+    for (;;) {
+	int c = Cell_Index(grid, cell[0], cell[1], cell[2]);
+	for (i = grid->cellStart[c]; i < grid->cellStart[c + 1]; i++) {
+	    int id = grid->cellGeo[i];
+	    if (mailbox[id & (grid_mailbox_size - 1)] == id)
+		continue;
+	    mailbox[id & (grid_mailbox_size - 1)] = id;
+
+	    if (!dst) {
+		if (Occludes_Geo(ray, grid->geometry[id], tmax))
+		    return true;
+	    } else if (Distance_Geo(ray, grid->geometry[id], tmax, &t)) {
+		tmax = dst->t = t;
+		dst->geo = grid->geometry[id];
+		hit = true;
+	    }
+	}
+
+	/* step into the neighbouring cell the ray reaches first */
+	axis = 0;
+	if (tNext[1] < tNext[axis])
+	    axis = 1;
+	if (tNext[2] < tNext[axis])
+	    axis = 2;
+
+	/* anything we've hit is closer than whatever is in the cells further along */
+	if (tmax <= tNext[axis])
+	    break;
+
+	cell[axis] += step[axis];
+	if (cell[axis] == out[axis])
+	    break;
+	tNext[axis] += tDelta[axis];
+    }
+
+    return hit;
+}
+
+/* !Intersect_Grid
+ * \brief find the closest intersection of a ray with the objects in a grid
+ * \param ray the ray
+ * \param grid the grid
+ * \param tmax only intersections closer than this are returned
+ * \param dst where to write the t and geo of the closest hit, only touched if there is one, Attributes_Geo fills in the rest
+ * \return whether the ray hit anything
+ */
+bool Intersect_Grid(Rayf_t ray, Grid_t *grid, float tmax, Intersection_t *dst) {
+    return Walk_Grid(ray, grid, tmax, dst);
+}
+
+/* !Occluded_Grid
+ * \brief whether a ray hits any object in a grid before tmax
+ * \param ray the ray
+ * \param grid the grid
+ * \param tmax only objects closer than this count
+ */
+bool Occluded_Grid(Rayf_t ray, Grid_t *grid, float tmax) {
+    return Walk_Grid(ray, grid, tmax, NULL);
+}
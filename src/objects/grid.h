@@ -0,0 +1,68 @@
+/*! \file grid.h
+ *
+ * \brief A uniform grid over the geometry in a scene
+ *
+ * \author Joe Doliner
+ */
+
+#ifndef _GRID_H_
+#define _GRID_H_
+
+#include "bbox.h"
+#include "geometry.h"
+#include "intersection.h"
+
+#define grid_density		3.0f	/*!< how many cells we want per object */
+#define grid_max_res		256	/*!< the most cells we'll use along an axis */
+#define grid_mailbox_size	64	/*!< entries in the per ray mailbox, must be a power of 2 */
+
+/*! \brief a uniform grid
+ *
+ * the objects overlapping each cell are stored back to back in cellGeo,
+ * the ones in cell c are cellGeo[cellStart[c]] up to cellGeo[cellStart[c + 1]].
+ */
+typedef struct {
+    BBox_t		bBox;		/*!< the bounds of the grid */
+    int			res[3];		/*!< how many cells there are along each axis */
+    Vec3f_t		cellSize;	/*!< the size of a cell */
+    Vec3f_t		invCellSize;	/*!< the componentwise inverse of the size of a cell */
+    int			*cellStart;	/*!< where each cell's objects start in cellGeo */
+    int			*cellGeo;	/*!< indices into geometry for the objects in each cell */
+    int			nGeo;		/*!< the number of geometry objects in the grid */
+    Geometry_t		**geometry;	/*!< the geometry objects */
+} Grid_t;
+
+/* !Build_Grid
+ * \brief build a grid over geometry objects, the resolution is picked from how densely they're packed
+ * \param geometry the objects, which must all have their bounding box calculated
+ * \param nGeo the number of objects
+ */
+Grid_t *Build_Grid(Geometry_t **geometry, int nGeo);
+
+/* !Delete_Grid
+ * \brief free a grid, the geometry in it is left alone
+ */
+void Delete_Grid(Grid_t *grid);
+
+/* !Intersect_Grid
+ * \brief find the closest intersection of a ray with the objects in a grid
+ * \param ray the ray
+ * \param grid the grid
+ * \param tmax only intersections closer than this are returned
+ * \param dst where to write the t and geo of the closest hit, only touched if there is one, Attributes_Geo fills in the rest
+ * \return whether the ray hit anything
+ */
+bool Intersect_Grid(Rayf_t ray, Grid_t *grid, float tmax, Intersection_t *dst);
+
+/* !Occluded_Grid
+ * \brief whether a ray hits any object in a grid before tmax
+ * \param ray the ray
+ * \param grid the grid
+ * \param tmax only objects closer than this count
+ *
+ * this stops at the first object in the way rather than looking for the
+ * closest, which is all a shadow ray needs to know.
+ */
+bool Occluded_Grid(Rayf_t ray, Grid_t *grid, float tmax);
+
+#endif
@@ -8,6 +8,7 @@
 #ifndef _INTERSECTION_H_
 #define _INTERSECTION_H_
 
+#include <stdbool.h>
 #include "material.h"
 
 /*! struct for in intersection between a ray and a piece of geometry */
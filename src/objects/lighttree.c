@@ -0,0 +1,233 @@
+/*! \file lighttree.c
+ *
+ * \brief Implementation of a hierarchy over the lights in a scene
+ *
+ * \author Joe Doliner
+ */
+
+#include "lighttree.h"
+#include "../engine/defs.h"
+
+/* !Select_Lights
+ * \brief partially sort light[lo, hi) along an axis so light[k] is the one that belongs there
+ */
+static void Select_Lights(Light_t **light, int lo, int hi, int k, int axis) {
+    hi--;
+    while (lo < hi) {
+	float pivot = light[(lo + hi) / 2]->pos[axis];
+	int i = lo, j = hi;
+	while (i <= j) {
+	    while (light[i]->pos[axis] < pivot)
+		i++;
+	    while (light[j]->pos[axis] > pivot)
+		j--;
+	    if (i <= j) {
+		Light_t *tmp = light[i];
+		light[i++] = light[j];
+		light[j--] = tmp;
+	    }
+	}
+	if (k <= j)
+	    hi = j;
+	else if (k >= i)
+	    lo = i;
+	else
+	    return ;
+    }
+}
+
+/* !Weight_Light
+ * \brief how much a light counts toward a split, its intensity or 1 if the node has no power to go by
+ */
+static inline float Weight_Light(Light_t *light, bool byPower) {
+    return byPower ? Maxf(light->intensity, 0) : 1;
+}
+
+/* !Split_Lights
+ * \brief split light[first, first + n) along an axis so each side has about half the weight
+ * \return the first light of the second side, which always has at least one light in it and so does the first
+ *
+ * a binary search over how many lights go in the first side, each guess
+ * partially sorting them so the first side is the ones lowest along the axis.
+ */
+static int Split_Lights(Light_t **light, int first, int n, int axis, bool byPower, float total) {
+    int i, lo = 1, hi = n - 1;
+
+    while (lo < hi) {
+	int k = (lo + hi) / 2;
+	float below = 0;
+	Select_Lights(light, first, first + n, first + k, axis);
+	for (i = first; i < first + k; i++)
+	    below += Weight_Light(light[i], byPower);
+	if (below >= total / 2)
+	    hi = k;
+	else
+	    lo = k + 1;
+    }
+
+    Select_Lights(light, first, first + n, first + lo, axis);
+    return first + lo;
+}
+
+/* !Build_Node
+ * \brief recursively build the subtree over tree->light[first, first + n)
+ * \param depth how far below the root the subtree is
+ * \return the index of the root of the subtree
+ *
+ * lights are split along the widest axis of their positions where half the
+ * intensity is on each side, rather than half the lights. a bright light
+ * then ends up in a small node of its own near the root, where its power
+ * and its cosine bound aren't blurred with those of the dim lights around
+ * it. below light_median_depth the split is at the median instead, since a
+ * few bright lights could otherwise peel off one at a time and make the
+ * tree as deep as it has lights.
+ */
+static int Build_Node(Light_Tree_t *tree, int first, int n, int depth) {
+    int i, axis = 0, mid, index = tree->nNodes++;
+    Light_Node_t *node = &tree->nodes[index];
+    Vec3f_t d;
+
+    EmptyBBox(&node->bBox);
+    node->power = 0;
+    node->nLights = n;
+    for (i = first; i < first + n; i++) {
+	GrowPointBBox(&node->bBox, tree->light[i]->pos);
+	node->power += Weight_Light(tree->light[i], true);
+    }
+
+    if (n == 1) {
+	node->offset = first;
+	return index;
+    }
+
+    SubV3f(node->bBox.corner[1], node->bBox.corner[0], d);
+    if (d[1] > d[axis])
+	axis = 1;
+    if (d[2] > d[axis])
+	axis = 2;
+
+    if (depth < light_median_depth) {
+	bool byPower = node->power > 0;
+	mid = Split_Lights(tree->light, first, n, axis, byPower, byPower ? node->power : n);
+    } else {
+	mid = first + n / 2;
+	Select_Lights(tree->light, first, first + n, mid, axis);
+    }
+    Build_Node(tree, first, mid - first, depth + 1);
+    tree->nodes[index].offset = Build_Node(tree, mid, first + n - mid, depth + 1);
+
+    return index;
+}
+
+/* !Build_Lights
+ * \brief build a tree over some lights, splitting them along the widest axis where half their intensity is on each side
+ * \param light the lights
+ * \param nLights the number of lights, at least 1
+ */
+Light_Tree_t *Build_Lights(Light_t **light, int nLights) {
+    int i;
+    Light_Tree_t *tree = NEW(Light_Tree_t);
+    assert(nLights > 0);
+    tree->nLights = nLights;
+    tree->light = NEWVEC(Light_t *, nLights);
+    for (i = 0; i < nLights; i++)
+	tree->light[i] = light[i];
+
+    /* a binary tree with nLights leaves has 2 * nLights - 1 nodes */
+    tree->nNodes = 0;
+    tree->nodes = NEWVEC(Light_Node_t, 2 * nLights - 1);
+    Build_Node(tree, 0, nLights, 0);
+
+    return tree;
+}
+
+/* !Delete_Lights
+ * \brief free a tree, the lights in it are left alone
+ */
+void Delete_Lights(Light_Tree_t *tree) {
+    free(tree->nodes);
+    free(tree->light);
+    free(tree);
+}
+
+/* !Cos_Bound
+ * \brief the largest cosine the direction from a point to anywhere in a box makes with a normal
+ *
+ * the box is wrapped in a sphere, the direction to its center is turned
+ * toward the normal by the angle the sphere covers and the cosine of what's
+ * left is taken, 1 if the point is inside the sphere.
+ */
+static float Cos_Bound(BBox_t *box, Vec3f_t point, Vec3f_t normal) {
+    Vec3f_t center, toCenter, half;
+    CentroidBBox(box, center);
+    SubV3f(center, point, toCenter);
+    SubV3f(box->corner[1], center, half);
+
+    float dist2 = LengthSqV3f(toCenter), radius2 = LengthSqV3f(half);
+    if (dist2 <= radius2)
+	return 1.0f;
+
+    float dist = sqrtf(dist2);
+    float cosTheta = Maxf(Minf(DotV3f(toCenter, normal) / dist, 1.0f), -1.0f);
+    float sinAlpha = sqrtf(radius2) / dist;
+    float cosAlpha = sqrtf(1.0f - sinAlpha * sinAlpha);
+    if (cosTheta >= cosAlpha)
+	return 1.0f;
+
+    /* cos(theta - alpha) */
+    float sinTheta = sqrtf(Maxf(1.0f - cosTheta * cosTheta, 0));
+    return Maxf(cosTheta * cosAlpha + sinTheta * sinAlpha, 0);
+}
+
+/* !Importance
+ * \brief how much the lights under a node could add to a point, up to a constant
+ */
+static inline float Importance(Light_Node_t *node, Vec3f_t point, Vec3f_t normal, bool spec) {
+    float importance = node->power * Cos_Bound(&node->bBox, point, normal);
+    if (spec)
+	importance += node->nLights;
+    return importance;
+}
+
+/* !Sample_Lights
+ * \brief pick a light in proportion to how much it could light a point
+ * \param tree the tree
+ * \param point the point being shaded
+ * \param normal the surface normal at the point
+ * \param spec whether the surface has a highlight, which every light can add to
+ * \param u a random number in [0, 1) which decides the pick
+ * \param pdf where to write the chance the light was picked
+ * \return the light, NULL if no light can reach the point
+ */
+Light_t *Sample_Lights(Light_Tree_t *tree, Vec3f_t point, Vec3f_t normal, bool spec, float u, float *pdf) {
+    int index = 0;
+    float p = 1.0f;
+
+    while (tree->nodes[index].nLights > 1) {
+	int left = index + 1, right = tree->nodes[index].offset;
+	float wLeft = Importance(&tree->nodes[left], point, normal, spec);
+	float wRight = Importance(&tree->nodes[right], point, normal, spec);
+	if (wLeft + wRight <= 0)
+	    return NULL;
+
+	/* take a child and stretch u back over [0, 1) so it can decide the next step */
+	float pLeft = wLeft / (wLeft + wRight);
+	if (u < pLeft) {
+	    u = u / pLeft;
+	    p *= pLeft;
+	    index = left;
+	} else {
+	    u = (u - pLeft) / (1.0f - pLeft);
+	    p *= 1.0f - pLeft;
+	    index = right;
+	}
+	u = Minf(u, 0x1.fffffep-1f);
+    }
+
+    /* a lone light at the root still needs to be able to reach the point */
+    if (index == 0 && Importance(&tree->nodes[0], point, normal, spec) <= 0)
+	return NULL;
+
+    *pdf = p;
+    return tree->light[tree->nodes[index].offset];
+}
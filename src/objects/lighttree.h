@@ -0,0 +1,73 @@
+/*! \file lighttree.h
+ *
+ * \brief A hierarchy over the lights in a scene for picking a few of them to shade with
+ *
+ * \author Joe Doliner
+ *
+ * Shading a point with every light costs a shadow ray per light. With a
+ * light tree a fixed number of lights are picked instead, each one walking
+ * down from the root and taking a child with probability proportional to
+ * how much light it could send to the point: the total intensity under it,
+ * scaled by the largest cosine any of its lights could make with the
+ * normal. Dividing what a light gives by the chance it was picked keeps the
+ * average the same as shading with every light.
+ *
+ * A light's highlight doesn't depend on its intensity or on which side of
+ * the surface it's on, so when the material has one every light also gets
+ * a share of the probability for just being there. Nothing that could light
+ * the point is ever given no chance of being picked.
+ */
+
+#ifndef _LIGHTTREE_H_
+#define _LIGHTTREE_H_
+
+#include "bbox.h"
+#include "light.h"
+
+#define light_median_depth	32	/*!< below this depth nodes are split at the median, so the build can't recurse once per light */
+
+/*! \brief a node of the tree
+ *
+ * nodes are stored depth first, so the first child of an interior node
+ * always directly follows it in the array.
+ */
+typedef struct {
+    BBox_t		bBox;		/*!< bounds the positions of every light below this node */
+    float		power;		/*!< the sum of the intensities of the lights below this node */
+    int			nLights;	/*!< how many lights are below this node, 1 for a leaf */
+    int			offset;		/*!< leaf: the light in Light_Tree_t::light, interior: the second child */
+} Light_Node_t;
+
+/*! \brief a light tree */
+typedef struct {
+    int			nNodes;		/*!< the number of nodes in the tree */
+    Light_Node_t	*nodes;		/*!< the nodes, nodes[0] is the root */
+    int			nLights;	/*!< the number of lights in the tree */
+    Light_t		**light;	/*!< the lights in leaf order */
+} Light_Tree_t;
+
+/* !Build_Lights
+ * \brief build a tree over some lights, splitting them where their power times the size of each side is least
+ * \param light the lights
+ * \param nLights the number of lights, at least 1
+ */
+Light_Tree_t *Build_Lights(Light_t **light, int nLights);
+
+/* !Delete_Lights
+ * \brief free a tree, the lights in it are left alone
+ */
+void Delete_Lights(Light_Tree_t *tree);
+
+/* !Sample_Lights
+ * \brief pick a light in proportion to how much it could light a point
+ * \param tree the tree
+ * \param point the point being shaded
+ * \param normal the surface normal at the point
+ * \param spec whether the surface has a highlight, which every light can add to
+ * \param u a random number in [0, 1) which decides the pick
+ * \param pdf where to write the chance the light was picked
+ * \return the light, NULL if no light can reach the point
+ */
+Light_t *Sample_Lights(Light_Tree_t *tree, Vec3f_t point, Vec3f_t normal, bool spec, float u, float *pdf);
+
+#endif
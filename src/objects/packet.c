@@ -0,0 +1,174 @@
+/*! \file packet.c
+ *
+ * \brief Implementation of packets of coherent rays traced together
+ *
+ * \author Joe Doliner
+ */
+
+#include <float.h>
+#include "packet.h"
+#include "../engine/stats.h"
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+/* !Select_Lane
+ * \brief a where mask is set and b everywhere else
+ */
+static inline Lane_t Select_Lane(LaneMask_t mask, Lane_t a, Lane_t b) {
+    return (Lane_t) (((LaneMask_t) a & mask) | ((LaneMask_t) b & ~mask));
+}
+
+/* !Any_Lane
+ * \brief whether mask is set in any lane
+ */
+static inline bool Any_Lane(LaneMask_t mask) {
+    int i;
+    for (i = 0; i < packet_lanes; i++)
+	if (mask[i])
+	    return true;
+    return false;
+}
+
+/* !Sqrt_Lane
+ * \brief the square root of every lane, correctly rounded like sqrtf
+ */
+static inline Lane_t Sqrt_Lane(Lane_t x) {
+#ifdef __SSE__
+    return (Lane_t) _mm_sqrt_ps((__m128) x);
+#else
+    int i;
+    for (i = 0; i < packet_lanes; i++)
+	x[i] = sqrtf(x[i]);
+    return x;
+#endif
+}
+
+/* !Update_Packet
+ * \brief record the new closest hits in one group of a packet
+ */
+static inline void Update_Packet(Packet_t *packet, int group, LaneMask_t mask, Lane_t t, Geometry_t *geometry) {
+    int i;
+    if (!Any_Lane(mask))
+	return ;
+    packet->tmax[group] = Select_Lane(mask, t, packet->tmax[group]);
+    for (i = 0; i < packet_lanes; i++)
+	if (mask[i])
+	    packet->hit[group * packet_lanes + i] = geometry;
+}
+
+/* !Init_Packet
+ * \brief set up a packet of rays, none of which have hit anything yet
+ * \param packet the packet
+ * \param orig where the rays start
+ * \param dirs the direction of each ray
+ */
+void Init_Packet(Packet_t *packet, Vec3f_t orig, Vec3f_t dirs[packet_size]) {
+    int i, axis;
+    CopyV3f(orig, packet->orig);
+    for (i = 0; i < packet_size; i++) {
+	for (axis = 0; axis < 3; axis++) {
+	    packet->dir[axis][i / packet_lanes][i % packet_lanes] = dirs[i][axis];
+	    packet->invDir[axis][i / packet_lanes][i % packet_lanes] = 1.0f / dirs[i][axis];
+	}
+	packet->tmax[i / packet_lanes][i % packet_lanes] = FLT_MAX;
+	packet->hit[i] = NULL;
+    }
+}
+
+/* !IntersectBBox_Packet
+ * \brief whether any ray in a packet might hit something in a box before its closest hit so far
+ */
+bool IntersectBBox_Packet(Packet_t *packet, BBox_t *box) {
+    int g, i;
+    for (g = 0; g < packet_groups; g++) {
+	Lane_t t0 = {0, 0, 0, 0}, t1 = packet->tmax[g];
+	for (i = 0; i < 3; i++) {
+	    Lane_t tnear = (box->corner[0][i] - packet->orig[i]) * packet->invDir[i][g];
+	    Lane_t tfar = (box->corner[1][i] - packet->orig[i]) * packet->invDir[i][g];
+	    LaneMask_t swap = tnear > tfar;
+	    Lane_t lo = Select_Lane(swap, tfar, tnear), hi = Select_Lane(swap, tnear, tfar);
+	    t0 = Select_Lane(t0 > lo, t0, lo);
+	    t1 = Select_Lane(t1 < hi, t1, hi);
+	}
+	if (Any_Lane(t0 <= t1))
+	    return true;
+    }
+    return false;
+}
+
+/* !Sphere_Packet
+ * \brief intersect every ray in a packet with a sphere, the same sums as Intersect_Sphere done four rays at a time
+ */
+static void Sphere_Packet(Packet_t *packet, Geometry_t *geometry) {
+    int g;
+    float eps = Epsilon_Lane();
+    Vec3f_t orig;
+    SubV3f(packet->orig, geometry->trans, orig);
+    float c = LengthSqV3f(orig) - Sqrf(geometry->primitive->sphere.radius);
+
+    for (g = 0; g < packet_groups; g++) {
+	Lane_t dx = packet->dir[0][g], dy = packet->dir[1][g], dz = packet->dir[2][g];
+	Lane_t a = (dx * dx) + (dy * dy) + (dz * dz);
+	Lane_t b = 2.0f * ((dx * orig[0]) + (dy * orig[1]) + (dz * orig[2]));
+	Lane_t D = (b * b) - (4.0f * a * c);
+	LaneMask_t mask = D >= 0;
+	if (!Any_Lane(mask))
+	    continue;
+
+	Lane_t root = Sqrt_Lane(Select_Lane(mask, D, (Lane_t) {0, 0, 0, 0}));
+	Lane_t t1 = (-b - root) / (2.0f * a), t2 = (-b + root) / (2.0f * a);
+	Lane_t t = Select_Lane(t1 < t2, t1, t2);
+	mask &= (t1 > eps) & (t2 > eps) & (t < packet->tmax[g]);
+	Update_Packet(packet, g, mask, t, geometry);
+    }
+}
+
+/* !Plane_Packet
+ * \brief intersect every ray in a packet with a plane, the same sums as Intersect_Plane done four rays at a time
+ */
+static void Plane_Packet(Packet_t *packet, Geometry_t *geometry) {
+    int g;
+    float eps = Epsilon_Lane();
+    Geo_Plane_t *plane = &geometry->primitive->plane;
+    Vec3f_t orig;
+    SubV3f(packet->orig, geometry->trans, orig);
+    float num = - (DotV3f(plane->N, orig) - DotV3f(plane->N, plane->P));
+
+    for (g = 0; g < packet_groups; g++) {
+	Lane_t denom = (plane->N[0] * packet->dir[0][g]) + (plane->N[1] * packet->dir[1][g]) +
+	    (plane->N[2] * packet->dir[2][g]);
+	Lane_t t = num / denom;
+	Update_Packet(packet, g, (t > eps) & (t < packet->tmax[g]), t, geometry);
+    }
+}
+
+/* !IntersectGeo_Packet
+ * \brief intersect every ray in a packet with an object, updating the closest hits
+ *
+ * spheres and planes have SIMD kernels, anything else is tested a ray at a time.
+ */
+void IntersectGeo_Packet(Packet_t *packet, Geometry_t *geometry) {
+    int i;
+    /* the kernels only know how to translate, scaled and rotated objects take the long way round too */
+    switch (geometry->transform ? NUM_PRIMS : geometry->prim_type) {
+	case SPHERE:
+	    STAT_ADD(STAT_SPHERE_TESTS, packet_size);
+	    Sphere_Packet(packet, geometry);
+	    break;
+	case PLANE:
+	    STAT_ADD(STAT_PLANE_TESTS, packet_size);
+	    Plane_Packet(packet, geometry);
+	    break;
+	default:
+	    for (i = 0; i < packet_size; i++) {
+		Rayf_t ray;
+		float t;
+		Ray_Packet(packet, i, &ray);
+		if (Distance_Geo(ray, geometry, packet->tmax[i / packet_lanes][i % packet_lanes], &t)) {
+		    packet->tmax[i / packet_lanes][i % packet_lanes] = t;
+		    packet->hit[i] = geometry;
+		}
+	    }
+    }
+}
@@ -0,0 +1,86 @@
+/*! \file packet.h
+ *
+ * \brief Packets of coherent rays traced together
+ *
+ * \author Joe Doliner
+ *
+ * Primary rays from neighbouring pixels start at the camera and point in
+ * almost the same direction, so they tend to visit the same bounding boxes
+ * and hit the same objects. A packet carries a packet_width x packet_width
+ * block of them in SIMD lanes and tests them all against a box or an object
+ * at once, skipping it when every ray misses.
+ *
+ * The packet only works out which object each ray hits first, the
+ * intersection itself is then filled in by Intersect_Geo on that one
+ * object so the result is exactly what tracing the rays one at a time
+ * gives.
+ */
+
+#ifndef _PACKET_H_
+#define _PACKET_H_
+
+#include <math.h>
+#include "geometry.h"
+#include "bbox.h"
+
+#define packet_width	4				/*!< a packet covers packet_width x packet_width pixels */
+#define packet_size	(packet_width * packet_width)	/*!< the number of rays in a packet */
+#define packet_lanes	4				/*!< rays in a Lane_t */
+#define packet_groups	(packet_size / packet_lanes)	/*!< Lane_ts in a packet */
+
+typedef float Lane_t __attribute__ ((vector_size (packet_lanes * sizeof(float))));	/*!< a float for each of packet_lanes rays */
+typedef int LaneMask_t __attribute__ ((vector_size (packet_lanes * sizeof(int))));	/*!< a comparison of Lane_ts, -1 where true */
+
+/* !Epsilon_Lane
+ * \brief the largest float no bigger than EPSILON
+ *
+ * the scalar code compares floats against EPSILON as a double, comparing
+ * against this instead gives the same answer for every float.
+ */
+static inline float Epsilon_Lane() {
+    float e = (float) EPSILON;
+    if ((double) e > EPSILON)
+	e = nextafterf(e, 0.0f);
+    return e;
+}
+
+/*! \brief a packet of rays sharing an origin */
+typedef struct {
+    Vec3f_t		orig;				/*!< where every ray starts */
+    Lane_t		dir[3][packet_groups];		/*!< the direction of each ray */
+    Lane_t		invDir[3][packet_groups];	/*!< 1 / dir, for the bounding box tests */
+    Lane_t		tmax[packet_groups];		/*!< the closest hit so far along each ray */
+    Geometry_t		*hit[packet_size];		/*!< what each ray hits closest so far, NULL if nothing */
+} Packet_t;
+
+/* !Init_Packet
+ * \brief set up a packet of rays, none of which have hit anything yet
+ * \param packet the packet
+ * \param orig where the rays start
+ * \param dirs the direction of each ray
+ */
+void Init_Packet(Packet_t *packet, Vec3f_t orig, Vec3f_t dirs[packet_size]);
+
+/* !Ray_Packet
+ * \brief pull one ray out of a packet
+ */
+static inline void Ray_Packet(Packet_t *packet, int ray, Rayf_t *dst) {
+    CopyV3f(packet->orig, dst->orig);
+    dst->dir[0] = packet->dir[0][ray / packet_lanes][ray % packet_lanes];
+    dst->dir[1] = packet->dir[1][ray / packet_lanes][ray % packet_lanes];
+    dst->dir[2] = packet->dir[2][ray / packet_lanes][ray % packet_lanes];
+}
+
+/* !IntersectBBox_Packet
+ * \brief whether any ray in a packet might hit something in a box before its closest hit so far
+ */
+bool IntersectBBox_Packet(Packet_t *packet, BBox_t *box);
+
+/* !IntersectGeo_Packet
+ * \brief intersect every ray in a packet with an object, updating the closest hits
+ *
+ * spheres and planes have SIMD kernels, anything else is tested a ray at a time.
+ */
+void IntersectGeo_Packet(Packet_t *packet, Geometry_t *geometry);
+
+#endif
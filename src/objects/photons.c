@@ -0,0 +1,213 @@
+/*! \file photons.c
+ *
+ * \brief Implementation of a photon map, light left on surfaces by photons traced from the lights
+ *
+ * \author Joe Doliner
+ */
+
+#include <float.h>
+#include "photons.h"
+#include "../engine/defs.h"
+
+/*! \brief the photons found so far by a gather, a max heap on distance */
+typedef struct {
+    int			n;				/*!< how many photons have been found */
+    float		dist[photon_gather];		/*!< the squared distance to each, the farthest first */
+    Photon_t		*photon[photon_gather];		/*!< the photons */
+} Gather_t;
+
+/* !Swap_Photons
+ * \brief swap two photons
+ */
+static inline void Swap_Photons(Photon_t *a, Photon_t *b) {
+    Photon_t tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+/* !Select_Photons
+ * \brief partially sort photons[lo, hi) along an axis so photons[k] is the one that belongs there
+ */
+static void Select_Photons(Photon_t *photons, int lo, int hi, int k, int axis) {
+    hi--;
+    while (lo < hi) {
+	float pivot = photons[(lo + hi) / 2].pos[axis];
+	int i = lo, j = hi;
+	while (i <= j) {
+	    while (photons[i].pos[axis] < pivot)
+		i++;
+	    while (photons[j].pos[axis] > pivot)
+		j--;
+	    if (i <= j)
+		Swap_Photons(&photons[i++], &photons[j--]);
+	}
+	if (k <= j)
+	    hi = j;
+	else if (k >= i)
+	    lo = i;
+	else
+	    return ;
+    }
+}
+
+/* !Build_Tree
+ * \brief sort photons[lo, hi) into a balanced kd-tree, splitting each range where it's widest
+ */
+static void Build_Tree(Photon_t *photons, int lo, int hi) {
+    int i, axis = 0;
+    Vec3f_t min = {FLT_MAX, FLT_MAX, FLT_MAX}, max = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+
+    if (hi - lo <= 0)
+	return ;
+
+    for (i = lo; i < hi; i++) {
+	int k;
+	for (k = 0; k < 3; k++) {
+	    min[k] = Minf(min[k], photons[i].pos[k]);
+	    max[k] = Maxf(max[k], photons[i].pos[k]);
+	}
+    }
+    if (max[1] - min[1] > max[axis] - min[axis])
+	axis = 1;
+    if (max[2] - min[2] > max[axis] - min[axis])
+	axis = 2;
+
+    int mid = lo + (hi - lo) / 2;
+    Select_Photons(photons, lo, hi, mid, axis);
+    photons[mid].axis = axis;
+    Build_Tree(photons, lo, mid);
+    Build_Tree(photons, mid + 1, hi);
+}
+
+/* !Build_Photons
+ * \brief build a photon map, the photons are sorted into kd-trees
+ * \param photons the photons, the map takes them over
+ * \param nPhotons the number of photons
+ * \param nGeo the number of objects in the scene, every photon's id must be less than this
+ */
+Photon_Map_t *Build_Photons(Photon_t *photons, int nPhotons, int nGeo) {
+    int i;
+    Photon_Map_t *map = NEW(Photon_Map_t);
+    map->nPhotons = nPhotons;
+    map->nGeo = nGeo;
+    map->start = NEWVEC(int, nGeo + 1);
+    map->photons = NEWVEC(Photon_t, nPhotons > 0 ? nPhotons : 1);
+
+    /* group the photons by object with a counting sort, which keeps them in the order they were traced */
+    for (i = 0; i <= nGeo; i++)
+	map->start[i] = 0;
+    for (i = 0; i < nPhotons; i++) {
+	assert(photons[i].id >= 0 && photons[i].id < nGeo);
+	map->start[photons[i].id + 1]++;
+    }
+    for (i = 0; i < nGeo; i++)
+	map->start[i + 1] += map->start[i];
+
+    int *next = NEWVEC(int, nGeo > 0 ? nGeo : 1);
+    for (i = 0; i < nGeo; i++)
+	next[i] = map->start[i];
+    for (i = 0; i < nPhotons; i++)
+	map->photons[next[photons[i].id]++] = photons[i];
+    free(next);
+    free(photons);
+
+    for (i = 0; i < nGeo; i++)
+	Build_Tree(map->photons, map->start[i], map->start[i + 1]);
+
+    return map;
+}
+
+/* !Delete_Photons
+ * \brief free a photon map and its photons
+ */
+void Delete_Photons(Photon_Map_t *map) {
+    free(map->photons);
+    free(map->start);
+    free(map);
+}
+
+/* !Push_Gather
+ * \brief offer a photon to a gather, it's kept if it's closer than the farthest one found so far
+ */
+static void Push_Gather(Gather_t *gather, Photon_t *photon, float dist) {
+    int i, child;
+
+    if (gather->n < photon_gather) {
+	/* sift the new photon up from the bottom */
+	i = gather->n++;
+	while (i > 0 && gather->dist[(i - 1) / 2] < dist) {
+	    gather->dist[i] = gather->dist[(i - 1) / 2];
+	    gather->photon[i] = gather->photon[(i - 1) / 2];
+	    i = (i - 1) / 2;
+	}
+    } else {
+	if (dist >= gather->dist[0])
+	    return ;
+	/* replace the farthest and sift it down */
+	i = 0;
+	while ((child = 2 * i + 1) < photon_gather) {
+	    if (child + 1 < photon_gather && gather->dist[child + 1] > gather->dist[child])
+		child++;
+	    if (gather->dist[child] <= dist)
+		break;
+	    gather->dist[i] = gather->dist[child];
+	    gather->photon[i] = gather->photon[child];
+	    i = child;
+	}
+    }
+    gather->dist[i] = dist;
+    gather->photon[i] = photon;
+}
+
+/* !Search_Tree
+ * \brief look for the photons nearest a point in the kd-tree over photons[lo, hi)
+ */
+static void Search_Tree(Photon_t *photons, int lo, int hi, Vec3f_t pos, Gather_t *gather) {
+    if (hi - lo <= 0)
+	return ;
+
+    int mid = lo + (hi - lo) / 2;
+    Photon_t *photon = &photons[mid];
+    float d = pos[photon->axis] - photon->pos[photon->axis];
+    Vec3f_t diff;
+
+    /* the side the point is on first, then the other side if it could still have anything closer */
+    if (d < 0)
+	Search_Tree(photons, lo, mid, pos, gather);
+    else
+	Search_Tree(photons, mid + 1, hi, pos, gather);
+
+    SubV3f(pos, photon->pos, diff);
+    Push_Gather(gather, photon, LengthSqV3f(diff));
+
+    if (gather->n < photon_gather || d * d < gather->dist[0]) {
+	if (d < 0)
+	    Search_Tree(photons, mid + 1, hi, pos, gather);
+	else
+	    Search_Tree(photons, lo, mid, pos, gather);
+    }
+}
+
+/* !Gather_Photons
+ * \brief average the light carried by the photons on an object nearest a point
+ * \param map the photon map
+ * \param pos the point
+ * \param id the object the point is on, photons on anything else are ignored
+ * \param dst where to write the light, black if no photon landed on the object
+ */
+void Gather_Photons(Photon_Map_t *map, Vec3f_t pos, int id, Colorf_t dst) {
+    int i, k;
+    Gather_t gather;
+
+    gather.n = 0;
+    Search_Tree(map->photons, map->start[id], map->start[id + 1], pos, &gather);
+
+    dst[0] = dst[1] = dst[2] = 0;
+    dst[3] = 1;
+    for (i = 0; i < gather.n; i++)
+	for (k = 0; k < 3; k++)
+	    dst[k] += gather.photon[i]->power[k];
+    if (gather.n > 0)
+	for (k = 0; k < 3; k++)
+	    dst[k] /= gather.n;
+}
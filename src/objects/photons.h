@@ -0,0 +1,65 @@
+/*! \file photons.h
+ *
+ * \brief A photon map, light left on surfaces by photons traced from the lights
+ *
+ * \author Joe Doliner
+ *
+ * The photons are grouped by the object they landed on, and each object's
+ * photons are kept in a balanced kd-tree laid out in a single run of the
+ * array with no pointers: the photon splitting a range sits in the middle
+ * of it, everything below it on the split axis is in the half before and
+ * everything above in the half after. Nearby photons end up near each other
+ * in memory, and a gather only ever walks down index ranges of one object.
+ *
+ * A gather finds the photons closest to a point on an object and averages
+ * the light they carry, which is what a rex texel holds for the light thrown
+ * at it, so shading can use either in the same way.
+ */
+
+#ifndef _PHOTONS_H_
+#define _PHOTONS_H_
+
+#include "../engine/vector.h"
+
+#define photon_gather		32	/*!< how many photons a gather averages */
+#define photon_max_bounces	8	/*!< the most times a photon is stored, Russian roulette usually stops it first */
+
+/*! \brief a photon resting on a surface */
+typedef struct {
+    Vec3f_t		pos;		/*!< where it landed */
+    Vec3f_t		power;		/*!< the light it carries */
+    int			id;		/*!< the geometry object it landed on */
+    int			axis;		/*!< the axis it splits its range of the tree along */
+} Photon_t;
+
+/*! \brief a photon map */
+typedef struct {
+    int			nPhotons;	/*!< the number of photons */
+    Photon_t		*photons;	/*!< the photons, a kd-tree for each object back to back */
+    int			nGeo;		/*!< the number of objects photons could land on */
+    int			*start;		/*!< where each object's tree starts in photons, with nGeo + 1 entries */
+} Photon_Map_t;
+
+/* !Build_Photons
+ * \brief build a photon map, the photons are sorted into kd-trees
+ * \param photons the photons, the map takes them over
+ * \param nPhotons the number of photons
+ * \param nGeo the number of objects in the scene, every photon's id must be less than this
+ */
+Photon_Map_t *Build_Photons(Photon_t *photons, int nPhotons, int nGeo);
+
+/* !Delete_Photons
+ * \brief free a photon map and its photons
+ */
+void Delete_Photons(Photon_Map_t *map);
+
+/* !Gather_Photons
+ * \brief average the light carried by the photons on an object nearest a point
+ * \param map the photon map
+ * \param pos the point
+ * \param id the object the point is on, photons on anything else are ignored
+ * \param dst where to write the light, black if no photon landed on the object
+ */
+void Gather_Photons(Photon_Map_t *map, Vec3f_t pos, int id, Colorf_t dst);
+
+#endif
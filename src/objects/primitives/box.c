@@ -8,45 +8,33 @@
 #include "../geometry.h"
 #include <float.h>
 
-/*! \brief intersect a ray with a box, only returns the first intersection point
+/*! \brief find how far along a ray it first hits a box, without working out anything else about the hit
  */
-Intersection_t *Intersect_Box(Rayf_t *ray, Geo_Box_t *box) {
-    bool hit; /* did we get a hit */
-    int i;
-
-    Vec3f_t normal; /* the normal at the intersection with the best t */
-    Vec3f_t xpoint; /* the intersection point at the intersection with the best t */
-    float t_to_beat = FLT_MAX;
-
-    for (i = 0; i < 3; i++) {
-	float r; /* the radius of side that's facing us */
-	float t; /* the parameter of the intersection */
-
-	/* which side is facing the ray */
-	if(ray->dir[i] < 0)
-	    r = box->r[i];
-	else
-	    r = -box->r[i];
-
-	t = (r - ray->orig[i]) / ray->dir[i];
-	RayToPointf(ray, t, xpoint);
-
-	/* checks to make sure the t is valid and that the point of intersection occurs inside the bounds of the box */
-	if (0 < t && t < t_to_beat && Absf(xpoint[(i + 1) % 3]) <= box->r[(i + 1) % 3] && Absf(xpoint[(i + 2) % 3]) <= box->r[(i + 2) % 3]) {
-	    t_to_beat = t;
-	    normal[0] = normal[1] = normal[2] = 0.0;
-	    normal[i] = 1.0;
-	    hit = true;
-	}
-    }
-
-    if (hit) {
-	Intersection_t *intersection = NEW(Intersection_t);
-	intersection->t = t_to_beat;
-	RayToPointf(ray, t_to_beat, intersection->point);
-	CopyV3f(normal, intersection->norm);
-	return intersection;
-    }
+bool Distance_Box(Rayf_t *ray, Geo_Box_t *box, float *t) {
+    Ray4f_t r = LoadRay4f(ray);
+    return Slabs_Box(&r, LoadV4f(box->r), t) >= 0;
+}
 
-    return NULL;
+/*! \brief work out the point, normal and texture coordinates of a hit found by Distance_Box
+ */
+void Attributes_Box(Rayf_t *ray, Geo_Box_t *box, float t, Intersection_t *dst) {
+    Ray4f_t r = LoadRay4f(ray);
+    V4f_t R = LoadV4f(box->r), P, N = {0, 0, 0, 0}, uv;
+    /* finding the face again is a few divides, cheaper than carrying it out of every test */
+    int face = Slabs_Box(&r, R, &t);
+    assert(face >= 0);
+
+    dst->t = t;
+    P = RayToPoint4f(&r, t);
+    StoreV4f(P, dst->point);
+    /* the face a ray comes in through faces back toward it, a normal that
+     * always points along +face would light the faces on the negative side
+     * from behind */
+    N[face] = ray->dir[face] < 0 ? 1.0 : -1.0;
+    StoreV4f(N, dst->norm);
+
+    /* texture coordinates run across whichever face we hit, so rexes and radiosity can land on boxes */
+    uv = (P / R + 1) / 2;
+    dst->u = Clampf(uv[(face + 1) % 3]);
+    dst->v = Clampf(uv[(face + 2) % 3]);
 }
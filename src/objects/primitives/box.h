@@ -8,6 +8,7 @@
 #ifndef _BOX_H_
 #define _BOX_H_
 
+#include <float.h>
 #include "../intersection.h"
 
 /*! structure to store a box
@@ -17,8 +18,45 @@ typedef struct {
 } Geo_Box_t;
 
 /*! \brief intersect a ray with a box, only returns the first intersection point
+ *  \param dst where to write the intersection
+ *  \return whether the ray hit the box
  */
-Intersection_t *Intersect_Box(Rayf_t *ray, Geo_Box_t *box);
+void Attributes_Box(Rayf_t *ray, Geo_Box_t *box, float t, Intersection_t *dst);
+
+/*! \brief find how far along a ray it first hits a box, without working out anything else about the hit
+ *  \param t where to write the parameter of the intersection
+ *  \return whether the ray hit the box
+ */
+bool Distance_Box(Rayf_t *ray, Geo_Box_t *box, float *t);
+
+/*! \brief the slab test behind Distance_Box, also run by the box loop of a primitive table
+ *
+ * the t of the face of each slab that's facing the ray is found for all three
+ * axes in one subtract and one divide, then each is kept if the point it gives
+ * is inside the other two slabs.
+ *  \param ray the ray, with its origin relative to the center of the box
+ *  \param r the half extents of the box
+ *  \param t where to write the parameter of the intersection
+ *  \return the axis the face hit is across, or -1 if the ray misses the box
+ */
+static inline int Slabs_Box(Ray4f_t *ray, V4f_t r, float *t) {
+    int i, face = -1;
+    float near = FLT_MAX;
+    V4i_t down = ray->dir < 0;
+    V4f_t facing = (V4f_t) (((V4i_t) r & down) | ((V4i_t) -r & ~down));
+    V4f_t T = (facing - ray->orig) / ray->dir;
+
+    for (i = 0; i < 3; i++) {
+	V4i_t inside = AbsV4f(RayToPoint4f(ray, T[i])) <= r;
+	if (0 < T[i] && T[i] < near && inside[(i + 1) % 3] && inside[(i + 2) % 3]) {
+	    near = T[i];
+	    face = i;
+	}
+    }
+
+    *t = near;
+    return face;
+}
 
 
 #endif
@@ -8,62 +8,64 @@
 #include "../geometry.h"
 #include <float.h>
 
-/*! \brief intersect a ray with a box, only returns the first intersection point
+/*! \brief find how far along a ray it hits a plane, without working out anything else about the hit
  */
-Intersection_t *Intersect_Plane(Rayf_t *ray, Geo_Plane_t *plane) {
-    float t; /* parameter of intersection */
-
-    t = - (DotV3f(plane->N, ray->orig) - DotV3f(plane->N, plane->P)) / DotV3f(plane->N, ray->dir);
-
-    if (t > EPSILON) {
-	Intersection_t *intersection = NEW(Intersection_t);
-	intersection->t = t;
-	RayToPointf(ray, t, intersection->point);
-	CopyV3f(plane->N, intersection->norm);
+bool Distance_Plane(Rayf_t *ray, Geo_Plane_t *plane, float *t) {
+    V4f_t N = LoadV4f(plane->N);
+    *t = - (DotV4f(N, LoadV4f(ray->orig)) - DotV4f(N, LoadV4f(plane->P))) / DotV4f(N, LoadV4f(ray->dir));
+    return *t > EPSILON;
+}
 
-	/* compute texture coordinates */
-	/* first we need a coordinate system */
-	Vec3f_t v1 = {1, 0, 0}, v2;
-	if (ParallelV3f(v1, plane->N)) {
-	    v1[0] = 0;
-	    v1[1] = 1;
-	    v1[2] = 0;
-	}
+/*! \brief work out the directions in a plane its texture coordinates run along, once its normal is known
+ */
+void Basis_Plane(Geo_Plane_t *plane) {
+    /* x projected into the plane, or y if the plane faces along x */
+    Vec3f_t v1 = {1, 0, 0};
+    if (ParallelV3f(v1, plane->N)) {
+	v1[0] = 0;
+	v1[1] = 1;
+	v1[2] = 0;
+    }
 
-	Vec3f_t v1projN;
-	ProjectV3f(v1, plane->N, v1projN);
-	SubV3f(v1, v1projN, v1);
-	CrossV3f(v1, plane->N, v2);
+    Vec3f_t v1projN;
+    ProjectV3f(v1, plane->N, v1projN);
+    SubV3f(v1, v1projN, plane->U);
+    CrossV3f(plane->U, plane->N, plane->V);
 
-	NormalizeV3f(v1);
-	NormalizeV3f(v2);
+    NormalizeV3f(plane->U);
+    NormalizeV3f(plane->V);
+}
 
-	/* compute u and v coordinates */
-	Vec3f_t pvec;
-	SubV3f(intersection->point, plane->P, pvec);
-	float u = DotV3f(pvec, v1), v = DotV3f(pvec, v2);
+/*! \brief work out the point, normal and texture coordinates of a hit found by Distance_Plane
+ */
+void Attributes_Plane(Rayf_t *ray, Geo_Plane_t *plane, float t, Intersection_t *dst) {
+    Ray4f_t r = LoadRay4f(ray);
+    V4f_t point = RayToPoint4f(&r, t);
 
-	/* map u from [-infty, infty] to [0, 1] */
-	if (u < 0)
-	    u--;
-	else
-	    u++;
+    dst->t = t;
+    StoreV4f(point, dst->point);
+    CopyV3f(plane->N, dst->norm);
 
-	u = ((1 / u) + 1) / 2;
+    /* compute u and v coordinates */
+    V4f_t pvec = point - LoadV4f(plane->P);
+    float u = DotV4f(pvec, LoadV4f(plane->U)), v = DotV4f(pvec, LoadV4f(plane->V));
 
-	/* map v from [-infty, infty] to [0, 1] */
-	if (v < 0)
-	    v--;
-	else
-	    v++;
+    /* map u from [-infty, infty] to [0, 1] */
+    if (u < 0)
+	u--;
+    else
+	u++;
 
-	v = ((1 / v) + 1) / 2;
+    u = ((1 / u) + 1) / 2;
 
-	intersection->u = u;
-	intersection->v = v;
+    /* map v from [-infty, infty] to [0, 1] */
+    if (v < 0)
+	v--;
+    else
+	v++;
 
-	return intersection;
-    }
+    v = ((1 / v) + 1) / 2;
 
-    return NULL;
+    dst->u = u;
+    dst->v = v;
 }
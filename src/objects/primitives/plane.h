@@ -15,11 +15,25 @@
 typedef struct {
     Vec3f_t	N;	/* <! the normal of the plane */
     Vec3f_t	P;	/* <! a point in the plane */
+    Vec3f_t	U;	/* <! the direction u is measured along in the plane, set by Basis_Plane */
+    Vec3f_t	V;	/* <! the direction v is measured along in the plane, set by Basis_Plane */
 } Geo_Plane_t;
 
-/*! \brief intersect a ray with a box, only returns the first intersection point
+/*! \brief work out the directions in a plane its texture coordinates run along, once its normal is known
  */
-Intersection_t *Intersect_Plane(Rayf_t *ray, Geo_Plane_t *plane);
+void Basis_Plane(Geo_Plane_t *plane);
+
+/*! \brief work out the point, normal and texture coordinates of a hit found by Distance_Plane
+ *  \param t the parameter of the hit
+ *  \param dst where to write the intersection
+ */
+void Attributes_Plane(Rayf_t *ray, Geo_Plane_t *plane, float t, Intersection_t *dst);
+
+/*! \brief find how far along a ray it hits a plane, without working out anything else about the hit
+ *  \param t where to write the parameter of the intersection
+ *  \return whether the ray hit the plane
+ */
+bool Distance_Plane(Rayf_t *ray, Geo_Plane_t *plane, float *t);
 
 
 #endif
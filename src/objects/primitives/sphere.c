@@ -9,46 +9,55 @@
 #include "sphere.h"
 #include "math.h"
 
-/*! \brief intersect a ray with a sphere, only returns the first intersection point
+/*! \brief find how far along a ray it first hits a sphere, without working out anything else about the hit
  */
-Intersection_t *Intersect_Sphere(Rayf_t *ray, Geo_Sphere_t *sphere) {
+bool Distance_Sphere(Rayf_t *ray, Geo_Sphere_t *sphere, float *t) {
     /* values for the quadric equation */
-    float a = LengthSqV3f(ray->dir); 
-    float b = 2 * DotV3f(ray->dir, ray->orig);
-    float c = LengthSqV3f(ray->orig) - Sqrf(sphere->radius);
+    Ray4f_t r = LoadRay4f(ray);
+    float a = LengthSqV4f(r.dir);
+    float b = 2 * DotV4f(r.dir, r.orig);
+    float c = LengthSqV4f(r.orig) - Sqrf(sphere->radius);
     float D = Sqrf(b) - (4 * a * c);
 
     if (D >= 0) {
 	float t1 = (-b - sqrtf(D)) / (2 * a), t2 = (-b + sqrtf(D)) / (2 * a); /* two candidate intersection parameters */
-	float t; /* the smallest positive candidate intersection parameter */
 	
 	/* if only 1 is negative the ray starts inside the sphere
 	 * if both are negative the sphere is behind the ray
 	 * either way there's no intersection
 	 */
 	if (t1 <= EPSILON || t2 <= EPSILON)
-	    return NULL;
+	    return false;
 	else if (t1 <= EPSILON)
-	    t = t2;
+	    *t = t2;
 	else if (t2 <= EPSILON)
-	    t = t1;
+	    *t = t1;
 	else
-	    t = Minf(t1, t2);
+	    *t = Minf(t1, t2);
 
-	Intersection_t *intersection = NEW(Intersection_t);
-	intersection->t = t;
-	RayToPointf(ray, t, intersection->point);
-
-	/* for a sphere centered at the origin the normal of a point is the vector from the point to the origin */
-	CopyV3f(intersection->point, intersection->norm);
-	NormalizeV3f(intersection->norm);
-
-	/* compute texture coordinates */
-	intersection->u = ((atan2(intersection->norm[1], intersection->norm[0]) / 3.142) + 1) / 2; 
-	intersection->v = (intersection->norm[2] + 1) / 2;
-
-	return intersection;
+	return true;
     }
 
-    return NULL;
+    return false;
+}
+
+/*! \brief work out the point, normal and texture coordinates of a hit found by Distance_Sphere
+ */
+void Attributes_Sphere(Rayf_t *ray, Geo_Sphere_t *sphere, float t, Intersection_t *dst) {
+    Ray4f_t r = LoadRay4f(ray);
+    V4f_t point = RayToPoint4f(&r, t);
+    /* the normal comes from normalizing the point, so the radius isn't needed */
+    (void) sphere;
+
+    /* for a sphere centered at the origin the normal of a point is the vector from the point to the origin */
+    V4f_t norm = point;
+    NormalizeV4f(&norm);
+
+    dst->t = t;
+    StoreV4f(point, dst->point);
+    StoreV4f(norm, dst->norm);
+
+    /* compute texture coordinates */
+    dst->u = ((atan2(dst->norm[1], dst->norm[0]) / 3.142) + 1) / 2; 
+    dst->v = (dst->norm[2] + 1) / 2;
 }
@@ -15,7 +15,15 @@ typedef struct {
     float	radius;		/*!< the radius of the sphere */
 } Geo_Sphere_t;
 
-/*! \brief intersect a ray with a sphere, only returns the first intersection point
+/*! \brief work out the point, normal and texture coordinates of a hit found by Distance_Sphere
+ *  \param t the parameter of the hit
+ *  \param dst where to write the intersection
  */
-Intersection_t *Intersect_Sphere(Rayf_t *ray, Geo_Sphere_t *sphere);
+void Attributes_Sphere(Rayf_t *ray, Geo_Sphere_t *sphere, float t, Intersection_t *dst);
+
+/*! \brief find how far along a ray it first hits a sphere, without working out anything else about the hit
+ *  \param t where to write the parameter of the intersection
+ *  \return whether the ray hit the sphere
+ */
+bool Distance_Sphere(Rayf_t *ray, Geo_Sphere_t *sphere, float *t);
 #endif
@@ -8,9 +8,28 @@
 #include "../geometry.h"
 #include <float.h>
 
-/*! \brief intersect a ray with a torus, only returns the first intersection point
+/*! \brief work out the point, normal and texture coordinates of a hit found by Distance_Torus
+ *
+ * Distance_Torus never hits so this is never called, if it is the hit is
+ * left at the torus's center with no normal rather than bringing the
+ * render down.
  */
-Intersection_t *Intersect_Torus(Rayf_t *ray, Geo_Torus_t *torus) {
+void Attributes_Torus(Rayf_t *ray, Geo_Torus_t *torus, float t, Intersection_t *dst) {
     /* this is real hard maybe we'll get to this later */
-    return NULL;
+    (void) ray;
+    (void) torus;
+    dst->t = t;
+    dst->point[0] = dst->point[1] = dst->point[2] = 0;
+    dst->norm[0] = dst->norm[1] = dst->norm[2] = 0;
+    dst->u = dst->v = 0;
+}
+
+/*! \brief find how far along a ray it first hits a torus, without working out anything else about the hit
+ */
+bool Distance_Torus(Rayf_t *ray, Geo_Torus_t *torus, float *t) {
+    /* no more than Attributes_Torus can */
+    (void) ray;
+    (void) torus;
+    (void) t;
+    return false;
 }
@@ -16,7 +16,15 @@ typedef struct {
 } Geo_Torus_t;
 
 /*! \brief intersect a ray with a torus, only returns the first intersection point
+ *  \param dst where to write the intersection
+ *  \return whether the ray hit the torus
  */
-Intersection_t *Intersect_Torus(Rayf_t *ray, Geo_Torus_t *torus);
+void Attributes_Torus(Rayf_t *ray, Geo_Torus_t *torus, float t, Intersection_t *dst);
+
+/*! \brief find how far along a ray it first hits a torus, without working out anything else about the hit
+ *  \param t where to write the parameter of the intersection
+ *  \return whether the ray hit the torus
+ */
+bool Distance_Torus(Rayf_t *ray, Geo_Torus_t *torus, float *t);
 
 #endif
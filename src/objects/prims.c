@@ -0,0 +1,521 @@
+/*! \file prims.c
+ *
+ * \brief Implementation of a packed table of primitives, each type tested against a ray in a loop of its own
+ *
+ * \author Joe Doliner
+ */
+
+#include <float.h>
+#include "prims.h"
+#include "packet.h"
+#include "../engine/stats.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
+/*! \brief a kernel finds the closest sphere a ray hits in some slots of a table
+ *  \param t where to write the parameter of the closest hit
+ *  \return the slot of the closest sphere hit before tmax, -1 if there isn't one
+ */
+typedef int (*Sphere_Kernel_t)(Prim_Table_t *table, int first, int n, Rayf_t *ray, float tmax, float *t);
+
+/* !Closest_Scalar
+ * \brief the plain C kernel, the same sums as Distance_Sphere a sphere at a time
+ */
+static int Closest_Scalar(Prim_Table_t *table, int first, int n, Rayf_t *ray, float tmax, float *t) {
+    int i, best = -1;
+    float eps = Epsilon_Lane();
+    float a = LengthSqV3f(ray->dir);
+
+    for (i = first; i < first + n; i++) {
+	Vec3f_t orig = {ray->orig[0] - table->x[i], ray->orig[1] - table->y[i], ray->orig[2] - table->z[i]};
+	float b = 2 * DotV3f(ray->dir, orig);
+	float c = LengthSqV3f(orig) - table->r2[i];
+	float D = Sqrf(b) - (4 * a * c);
+
+	if (table->r2[i] < 0 || D < 0)
+	    continue;
+
+	float t1 = (-b - sqrtf(D)) / (2 * a), t2 = (-b + sqrtf(D)) / (2 * a);
+	float tt = Minf(t1, t2);
+	if (t1 > eps && t2 > eps && tt < tmax) {
+	    tmax = tt;
+	    best = i;
+	}
+    }
+
+    *t = tmax;
+    return best;
+}
+
+#ifdef HAVE_X86_KERNELS
+/* !Closest_AVX2
+ * \brief the AVX2 kernel, eight spheres at a time
+ *
+ * every lane keeps the closest hit it has seen, the lanes are only compared
+ * with each other at the end. ties go to the lowest slot like the scalar
+ * kernel, and contraction is turned off so the compiler can't fuse the
+ * multiplies and adds and round differently from Distance_Sphere.
+ */
+__attribute__ ((target ("avx2"), optimize ("fp-contract=off")))
+static int Closest_AVX2(Prim_Table_t *table, int first, int n, Rayf_t *ray, float tmax, float *t) {
+    int i, best = -1;
+    float a = LengthSqV3f(ray->dir);
+    __m256 dx = _mm256_set1_ps(ray->dir[0]), dy = _mm256_set1_ps(ray->dir[1]), dz = _mm256_set1_ps(ray->dir[2]);
+    __m256 ox = _mm256_set1_ps(ray->orig[0]), oy = _mm256_set1_ps(ray->orig[1]), oz = _mm256_set1_ps(ray->orig[2]);
+    __m256 twoA = _mm256_set1_ps(2 * a), fourA = _mm256_set1_ps(4 * a);
+    __m256 two = _mm256_set1_ps(2), zero = _mm256_setzero_ps(), eps = _mm256_set1_ps(Epsilon_Lane());
+    __m256 bestT = _mm256_set1_ps(tmax);
+    __m256i bestSlot = _mm256_set1_epi32(-1), slot = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i eight = _mm256_set1_epi32(8), last = _mm256_set1_epi32(first + n);
+
+    slot = _mm256_add_epi32(slot, _mm256_set1_epi32(first));
+    for (i = first; i < first + n; i += 8) {
+	/* the lanes past the end of the run are masked off rather than loaded */
+	__m256i live = _mm256_cmpgt_epi32(last, slot);
+	__m256 cx = _mm256_maskload_ps(table->x + i, live), cy = _mm256_maskload_ps(table->y + i, live);
+	__m256 cz = _mm256_maskload_ps(table->z + i, live), r2 = _mm256_maskload_ps(table->r2 + i, live);
+
+	__m256 px = _mm256_sub_ps(ox, cx), py = _mm256_sub_ps(oy, cy), pz = _mm256_sub_ps(oz, cz);
+	__m256 b = _mm256_mul_ps(two, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, px), _mm256_mul_ps(dy, py)), _mm256_mul_ps(dz, pz)));
+	__m256 c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, px), _mm256_mul_ps(py, py)), _mm256_mul_ps(pz, pz)), r2);
+	__m256 D = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(fourA, c));
+	__m256 mask = _mm256_and_ps(_mm256_castsi256_ps(live), _mm256_and_ps(_mm256_cmp_ps(r2, zero, _CMP_GE_OQ), _mm256_cmp_ps(D, zero, _CMP_GE_OQ)));
+
+	if (_mm256_movemask_ps(mask)) {
+	    __m256 root = _mm256_sqrt_ps(_mm256_and_ps(mask, D)), negB = _mm256_sub_ps(zero, b);
+	    __m256 t1 = _mm256_div_ps(_mm256_sub_ps(negB, root), twoA), t2 = _mm256_div_ps(_mm256_add_ps(negB, root), twoA);
+	    __m256 tt = _mm256_min_ps(t1, t2);
+	    mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(t1, eps, _CMP_GT_OQ), _mm256_cmp_ps(t2, eps, _CMP_GT_OQ)));
+	    mask = _mm256_and_ps(mask, _mm256_cmp_ps(tt, bestT, _CMP_LT_OQ));
+	    bestT = _mm256_blendv_ps(bestT, tt, mask);
+	    bestSlot = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(bestSlot), _mm256_castsi256_ps(slot), mask));
+	}
+	slot = _mm256_add_epi32(slot, eight);
+    }
+
+    float laneT[8];
+    int laneSlot[8];
+    _mm256_storeu_ps(laneT, bestT);
+    _mm256_storeu_si256((__m256i *) laneSlot, bestSlot);
+    for (i = 0; i < 8; i++) {
+	if (laneSlot[i] >= 0 && (laneT[i] < tmax || (laneT[i] == tmax && laneSlot[i] < best))) {
+	    tmax = laneT[i];
+	    best = laneSlot[i];
+	}
+    }
+
+    *t = tmax;
+    return best;
+}
+
+/* !Closest_AVX512
+ * \brief the AVX-512 kernel, sixteen spheres at a time, otherwise just like Closest_AVX2
+ */
+__attribute__ ((target ("avx512f"), optimize ("fp-contract=off")))
+static int Closest_AVX512(Prim_Table_t *table, int first, int n, Rayf_t *ray, float tmax, float *t) {
+    int i, best = -1;
+    float a = LengthSqV3f(ray->dir);
+    __m512 dx = _mm512_set1_ps(ray->dir[0]), dy = _mm512_set1_ps(ray->dir[1]), dz = _mm512_set1_ps(ray->dir[2]);
+    __m512 ox = _mm512_set1_ps(ray->orig[0]), oy = _mm512_set1_ps(ray->orig[1]), oz = _mm512_set1_ps(ray->orig[2]);
+    __m512 twoA = _mm512_set1_ps(2 * a), fourA = _mm512_set1_ps(4 * a);
+    __m512 two = _mm512_set1_ps(2), zero = _mm512_setzero_ps(), eps = _mm512_set1_ps(Epsilon_Lane());
+    __m512 bestT = _mm512_set1_ps(tmax);
+    __m512i bestSlot = _mm512_set1_epi32(-1);
+    __m512i slot = _mm512_add_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15), _mm512_set1_epi32(first));
+    __m512i sixteen = _mm512_set1_epi32(16);
+
+    for (i = first; i < first + n; i += 16) {
+	__mmask16 live = first + n - i >= 16 ? 0xFFFF : (__mmask16) ((1u << (first + n - i)) - 1);
+	__m512 cx = _mm512_maskz_loadu_ps(live, table->x + i), cy = _mm512_maskz_loadu_ps(live, table->y + i);
+	__m512 cz = _mm512_maskz_loadu_ps(live, table->z + i), r2 = _mm512_maskz_loadu_ps(live, table->r2 + i);
+
+	__m512 px = _mm512_sub_ps(ox, cx), py = _mm512_sub_ps(oy, cy), pz = _mm512_sub_ps(oz, cz);
+	__m512 b = _mm512_mul_ps(two, _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, px), _mm512_mul_ps(dy, py)), _mm512_mul_ps(dz, pz)));
+	__m512 c = _mm512_sub_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(px, px), _mm512_mul_ps(py, py)), _mm512_mul_ps(pz, pz)), r2);
+	__m512 D = _mm512_sub_ps(_mm512_mul_ps(b, b), _mm512_mul_ps(fourA, c));
+	__mmask16 mask = live & _mm512_cmp_ps_mask(r2, zero, _CMP_GE_OQ) & _mm512_cmp_ps_mask(D, zero, _CMP_GE_OQ);
+
+	if (mask) {
+	    __m512 root = _mm512_sqrt_ps(_mm512_maskz_mov_ps(mask, D)), negB = _mm512_sub_ps(zero, b);
+	    __m512 t1 = _mm512_div_ps(_mm512_sub_ps(negB, root), twoA), t2 = _mm512_div_ps(_mm512_add_ps(negB, root), twoA);
+	    __m512 tt = _mm512_min_ps(t1, t2);
+	    mask &= _mm512_cmp_ps_mask(t1, eps, _CMP_GT_OQ) & _mm512_cmp_ps_mask(t2, eps, _CMP_GT_OQ);
+	    mask &= _mm512_cmp_ps_mask(tt, bestT, _CMP_LT_OQ);
+	    bestT = _mm512_mask_blend_ps(mask, bestT, tt);
+	    bestSlot = _mm512_mask_blend_epi32(mask, bestSlot, slot);
+	}
+	slot = _mm512_add_epi32(slot, sixteen);
+    }
+
+    float laneT[16];
+    int laneSlot[16];
+    _mm512_storeu_ps(laneT, bestT);
+    _mm512_storeu_si512(laneSlot, bestSlot);
+    for (i = 0; i < 16; i++) {
+	if (laneSlot[i] >= 0 && (laneT[i] < tmax || (laneT[i] == tmax && laneSlot[i] < best))) {
+	    tmax = laneT[i];
+	    best = laneSlot[i];
+	}
+    }
+
+    *t = tmax;
+    return best;
+}
+#endif
+
+static Sphere_Kernel_t kernel = NULL;	/*!< the kernel every table uses, picked by Select_Kernel */
+static const char *kernelName = "scalar";	/*!< what it's called */
+
+/* !Select_Kernel
+ * \brief pick the widest kernel the CPU we're running on can do
+ */
+static void Select_Kernel() {
+    kernel = Closest_Scalar;
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+	kernel = Closest_AVX512;
+	kernelName = "avx512";
+    } else if (__builtin_cpu_supports("avx2")) {
+	kernel = Closest_AVX2;
+	kernelName = "avx2";
+    }
+#endif
+}
+
+/* !Closest_Boxes
+ * \brief the box loop, Slabs_Box on each box in turn like Distance_Box
+ */
+static int Closest_Boxes(Prim_Table_t *table, int first, int n, Rayf_t *ray, float tmax, float *t) {
+    int i, best = -1;
+    Ray4f_t r = LoadRay4f(ray);
+    V4f_t orig = r.orig;
+
+    for (i = first; i < first + n; i++) {
+	V4f_t R = {table->rx[i], table->ry[i], table->rz[i], 0};
+	float near;
+
+	r.orig = orig - (V4f_t) {table->x[i], table->y[i], table->z[i], 0};
+	if (Slabs_Box(&r, R, &near) >= 0 && near > EPSILON && near < tmax) {
+	    tmax = near;
+	    best = i;
+	}
+    }
+
+    *t = tmax;
+    return best;
+}
+
+/* !Closest_Planes
+ * \brief the plane loop, the same sums as Distance_Plane a plane at a time
+ */
+static int Closest_Planes(Prim_Table_t *table, int first, int n, Rayf_t *ray, float tmax, float *t) {
+    int i, best = -1;
+
+    for (i = first; i < first + n; i++) {
+	Vec3f_t orig = {ray->orig[0] - table->x[i], ray->orig[1] - table->y[i], ray->orig[2] - table->z[i]};
+	Vec3f_t N = {table->nx[i], table->ny[i], table->nz[i]};
+	float tt = - (DotV3f(N, orig) - table->np[i]) / DotV3f(N, ray->dir);
+
+	if (tt > EPSILON && tt < tmax) {
+	    tmax = tt;
+	    best = i;
+	}
+    }
+
+    *t = tmax;
+    return best;
+}
+
+/* !Occludes_Boxes
+ * \brief the box loop for shadow rays, which stops at the first box hit before tmax
+ * \return the slot of that box, -1 if there isn't one
+ */
+static int Occludes_Boxes(Prim_Table_t *table, int first, int n, Rayf_t *ray, float tmax) {
+    int i;
+    Ray4f_t r = LoadRay4f(ray);
+    V4f_t orig = r.orig;
+
+    for (i = first; i < first + n; i++) {
+	V4f_t R = {table->rx[i], table->ry[i], table->rz[i], 0};
+	float near;
+
+	r.orig = orig - (V4f_t) {table->x[i], table->y[i], table->z[i], 0};
+	if (Slabs_Box(&r, R, &near) >= 0 && near > EPSILON && near < tmax)
+	    return i;
+    }
+
+    return -1;
+}
+
+/* !Occludes_Planes
+ * \brief the plane loop for shadow rays, which stops at the first plane hit before tmax
+ * \return the slot of that plane, -1 if there isn't one
+ */
+static int Occludes_Planes(Prim_Table_t *table, int first, int n, Rayf_t *ray, float tmax) {
+    int i;
+
+    for (i = first; i < first + n; i++) {
+	Vec3f_t orig = {ray->orig[0] - table->x[i], ray->orig[1] - table->y[i], ray->orig[2] - table->z[i]};
+	Vec3f_t N = {table->nx[i], table->ny[i], table->nz[i]};
+	float tt = - (DotV3f(N, orig) - table->np[i]) / DotV3f(N, ray->dir);
+
+	if (tt > EPSILON && tt < tmax)
+	    return i;
+    }
+
+    return -1;
+}
+
+/* !Kind_Prims
+ * \brief which kind of slot an object goes in
+ */
+Slot_Kind_t Kind_Prims(Geometry_t *geometry) {
+    if (geometry->transform)
+	return SLOT_OTHER;
+    switch (geometry->prim_type) {
+	case SPHERE:
+	    return SLOT_SPHERE;
+	case BOX:
+	    return SLOT_BOX;
+	case PLANE:
+	    return SLOT_PLANE;
+	default:
+	    return SLOT_OTHER;
+    }
+}
+
+/* !Sort_Prims
+ * \brief group a run of objects by the kind of slot they go in, keeping their order within each kind
+ * \param geometry the objects, sorted in place
+ * \param nGeo the number of objects
+ * \param runs where to write how many objects of each kind there are
+ */
+void Sort_Prims(Geometry_t **geometry, int nGeo, Prim_Runs_t *runs) {
+    int i, k, total, next[NUM_SLOTS];
+    Geometry_t **sorted;
+
+    for (k = 0; k < NUM_SLOTS; k++)
+	runs->count[k] = 0;
+    for (i = 0; i < nGeo; i++)
+	runs->count[Kind_Prims(geometry[i])]++;
+
+    if (nGeo < 2)
+	return ;
+
+    /* a counting sort, which is stable */
+    for (k = 0, total = 0; k < NUM_SLOTS; k++) {
+	next[k] = total;
+	total += runs->count[k];
+    }
+
+    sorted = NEWVEC(Geometry_t *, nGeo);
+    for (i = 0; i < nGeo; i++)
+	sorted[next[Kind_Prims(geometry[i])]++] = geometry[i];
+    for (i = 0; i < nGeo; i++)
+	geometry[i] = sorted[i];
+    free(sorted);
+}
+
+/* !Build_Prims
+ * \brief lay out a run of geometry objects in a table
+ * \param geometry the objects, the table keeps them in this order, every run that's tested must be sorted by Sort_Prims
+ * \param nGeo the number of objects
+ */
+Prim_Table_t *Build_Prims(Geometry_t **geometry, int nGeo) {
+    int i;
+    Prim_Table_t *table = NEW(Prim_Table_t);
+
+    if (!kernel)
+	Select_Kernel();
+
+    table->nGeo = nGeo;
+    table->x = NEWVEC(float, nGeo);
+    table->y = NEWVEC(float, nGeo);
+    table->z = NEWVEC(float, nGeo);
+    table->r2 = NEWVEC(float, nGeo);
+    table->rx = NEWVEC(float, nGeo);
+    table->ry = NEWVEC(float, nGeo);
+    table->rz = NEWVEC(float, nGeo);
+    table->nx = NEWVEC(float, nGeo);
+    table->ny = NEWVEC(float, nGeo);
+    table->nz = NEWVEC(float, nGeo);
+    table->np = NEWVEC(float, nGeo);
+    table->geometry = NEWVEC(Geometry_t *, nGeo);
+
+    for (i = 0; i < nGeo; i++) {
+	Geometry_t *geo = geometry[i];
+	Slot_Kind_t kind = Kind_Prims(geo);
+
+	table->geometry[i] = geo;
+	table->x[i] = geo->trans[0];
+	table->y[i] = geo->trans[1];
+	table->z[i] = geo->trans[2];
+	table->r2[i] = kind == SLOT_SPHERE ? Sqrf(geo->primitive->sphere.radius) : -1;
+	table->rx[i] = table->ry[i] = table->rz[i] = 0;
+	table->nx[i] = table->ny[i] = table->nz[i] = table->np[i] = 0;
+	if (kind == SLOT_BOX) {
+	    table->rx[i] = geo->primitive->box.r[0];
+	    table->ry[i] = geo->primitive->box.r[1];
+	    table->rz[i] = geo->primitive->box.r[2];
+	} else if (kind == SLOT_PLANE) {
+	    table->nx[i] = geo->primitive->plane.N[0];
+	    table->ny[i] = geo->primitive->plane.N[1];
+	    table->nz[i] = geo->primitive->plane.N[2];
+	    table->np[i] = DotV3f(geo->primitive->plane.N, geo->primitive->plane.P);
+	}
+    }
+
+    return table;
+}
+
+/* !Delete_Prims
+ * \brief free a table, the geometry in it is left alone
+ */
+void Delete_Prims(Prim_Table_t *table) {
+    free(table->x);
+    free(table->y);
+    free(table->z);
+    free(table->r2);
+    free(table->rx);
+    free(table->ry);
+    free(table->rz);
+    free(table->nx);
+    free(table->ny);
+    free(table->nz);
+    free(table->np);
+    free(table->geometry);
+    free(table);
+}
+
+/* !Kernel_Prims
+ * \brief the name of the sphere kernel the tables are using, for reports
+ */
+const char *Kernel_Prims() {
+    if (!kernel)
+	Select_Kernel();
+    return kernelName;
+}
+
+/* !Runs_Prims
+ * \brief where each kind's run starts in some sorted slots of a table
+ * \param start where to write the first slot of each kind, start[NUM_SLOTS] is one past the last slot
+ */
+static inline void Runs_Prims(int first, Prim_Runs_t *runs, int start[NUM_SLOTS + 1]) {
+    int k;
+    start[0] = first;
+    for (k = 0; k < NUM_SLOTS; k++)
+	start[k + 1] = start[k] + runs->count[k];
+}
+
+/* !Intersect_Prims
+ * \brief find the closest intersection of a ray with the objects in some slots of a table
+ * \param table the table
+ * \param first the first slot to test
+ * \param runs how many slots of each kind to test, as Sort_Prims found them
+ * \param ray the ray
+ * \param tmax only intersections closer than this are returned
+ * \param dst where to write the t and geo of the closest hit, only touched if there is one, Attributes_Geo fills in the rest
+ * \return whether the ray hit anything
+ */
+bool Intersect_Prims(Prim_Table_t *table, int first, Prim_Runs_t *runs, Rayf_t ray, float tmax, Intersection_t *dst) {
+    int i, best, start[NUM_SLOTS + 1];
+    int nSpheres, nBoxes, nPlanes;
+    Geometry_t *closest = NULL;
+    float t;
+
+    Runs_Prims(first, runs, start);
+    nSpheres = start[SLOT_SPHERE + 1] - start[SLOT_SPHERE];
+    nBoxes = start[SLOT_BOX + 1] - start[SLOT_BOX];
+    nPlanes = start[SLOT_PLANE + 1] - start[SLOT_PLANE];
+
+    if (nSpheres > 0) {
+	best = kernel(table, start[SLOT_SPHERE], nSpheres, &ray, tmax, &t);
+	/* Distance_Geo counts the test of the sphere that was hit */
+	STAT_ADD(STAT_SPHERE_TESTS, best < 0 ? nSpheres : nSpheres - 1);
+	if (best >= 0 && Distance_Geo(ray, table->geometry[best], FLT_MAX, &t)) {
+	    tmax = t;
+	    closest = table->geometry[best];
+	}
+    }
+
+    if (nBoxes > 0) {
+	STAT_ADD(STAT_BOX_TESTS, nBoxes);
+	if ((best = Closest_Boxes(table, start[SLOT_BOX], nBoxes, &ray, tmax, &t)) >= 0) {
+	    STAT_INC(STAT_PRIM_HITS);
+	    tmax = t;
+	    closest = table->geometry[best];
+	}
+    }
+
+    if (nPlanes > 0) {
+	STAT_ADD(STAT_PLANE_TESTS, nPlanes);
+	if ((best = Closest_Planes(table, start[SLOT_PLANE], nPlanes, &ray, tmax, &t)) >= 0) {
+	    STAT_INC(STAT_PRIM_HITS);
+	    tmax = t;
+	    closest = table->geometry[best];
+	}
+    }
+
+    /* everything else goes the long way round */
+    for (i = start[SLOT_OTHER]; i < start[NUM_SLOTS]; i++) {
+	if (Distance_Geo(ray, table->geometry[i], tmax, &t)) {
+	    tmax = t;
+	    closest = table->geometry[i];
+	}
+    }
+
+    if (!closest)
+	return false;
+    dst->t = tmax;
+    dst->geo = closest;
+    return true;
+}
+
+/* !Occluded_Prims
+ * \brief whether a ray hits any object in some slots of a table before tmax
+ */
+bool Occluded_Prims(Prim_Table_t *table, int first, Prim_Runs_t *runs, Rayf_t ray, float tmax) {
+    int i, hit, start[NUM_SLOTS + 1];
+    int nSpheres, nBoxes, nPlanes;
+    float t;
+
+    Runs_Prims(first, runs, start);
+    nSpheres = start[SLOT_SPHERE + 1] - start[SLOT_SPHERE];
+    nBoxes = start[SLOT_BOX + 1] - start[SLOT_BOX];
+    nPlanes = start[SLOT_PLANE + 1] - start[SLOT_PLANE];
+
+    if (nSpheres > 0) {
+	STAT_ADD(STAT_SPHERE_TESTS, nSpheres);
+	if (kernel(table, start[SLOT_SPHERE], nSpheres, &ray, tmax, &t) >= 0) {
+	    STAT_INC(STAT_PRIM_HITS);
+	    return true;
+	}
+    }
+
+    if (nBoxes > 0) {
+	hit = Occludes_Boxes(table, start[SLOT_BOX], nBoxes, &ray, tmax);
+	STAT_ADD(STAT_BOX_TESTS, hit < 0 ? nBoxes : hit - start[SLOT_BOX] + 1);
+	if (hit >= 0) {
+	    STAT_INC(STAT_PRIM_HITS);
+	    return true;
+	}
+    }
+
+    if (nPlanes > 0) {
+	hit = Occludes_Planes(table, start[SLOT_PLANE], nPlanes, &ray, tmax);
+	STAT_ADD(STAT_PLANE_TESTS, hit < 0 ? nPlanes : hit - start[SLOT_PLANE] + 1);
+	if (hit >= 0) {
+	    STAT_INC(STAT_PRIM_HITS);
+	    return true;
+	}
+    }
+
+    for (i = start[SLOT_OTHER]; i < start[NUM_SLOTS]; i++)
+	if (Occludes_Geo(ray, table->geometry[i], tmax))
+	    return true;
+
+    return false;
+}
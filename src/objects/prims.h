@@ -0,0 +1,118 @@
+/*! \file prims.h
+ *
+ * \brief A packed table of primitives, each type tested against a ray in a loop of its own
+ *
+ * \author Joe Doliner
+ *
+ * Going through Distance_Geo costs a pointer chase to the geometry, another
+ * to its primitive and a switch on the type for every object a ray is tested
+ * against. A primitive table keeps the centers and squared radii of a run of
+ * geometry objects back to back in separate arrays, so a SIMD kernel can load
+ * sphere_lanes of them at once and pick the closest hit with vector compares.
+ *
+ * Boxes and planes get arrays of their own too, their half extents and their
+ * normals and offsets, and each kind is tested by a loop of its own with no
+ * switch and no pointers to follow. Every run of slots a table is asked about
+ * has to have been grouped by Sort_Prims first, spheres then boxes then
+ * planes then everything else, so each kind is a run of its own inside it
+ * and the loops never look at a slot they can't handle. Sort_Prims hands back
+ * how many of each kind it found, and whoever owns the run keeps that to say
+ * where each kind starts when the run is tested. What's left, tori and
+ * anything with a transform, is tested one by one as before.
+ *
+ * The sphere kernel only works out which sphere is hit first, its distance is
+ * worked out again by Distance_Geo on that one sphere. The box and plane
+ * loops do the same sums as Distance_Box and Distance_Plane, so the result is
+ * exactly what testing the objects one at a time gives.
+ *
+ * The kernel is picked when the first table is built: AVX-512 if the CPU has
+ * it, then AVX2, then plain C.
+ */
+
+#ifndef _PRIMS_H_
+#define _PRIMS_H_
+
+#include "geometry.h"
+#include "intersection.h"
+
+#define sphere_lanes	16	/*!< the most spheres a kernel tests at once */
+
+/*! the kinds of slot in a table, in the order Sort_Prims groups them */
+typedef enum {
+    SLOT_SPHERE = 0,		/*!< a sphere that's only translated */
+    SLOT_BOX,			/*!< a box that's only translated */
+    SLOT_PLANE,			/*!< a plane that's only translated */
+    SLOT_OTHER,			/*!< anything else, tested with Distance_Geo */
+    NUM_SLOTS
+} Slot_Kind_t;
+
+/*! \brief a run of geometry objects laid out for the loops */
+typedef struct {
+    int			nGeo;		/*!< the number of slots in the table */
+    float		*x;		/*!< the x coordinate of each object's translation */
+    float		*y;		/*!< the y coordinate of each object's translation */
+    float		*z;		/*!< the z coordinate of each object's translation */
+    float		*r2;		/*!< each sphere's radius squared, negative if the slot isn't a sphere */
+    float		*rx;		/*!< each box's half extent along x */
+    float		*ry;		/*!< each box's half extent along y */
+    float		*rz;		/*!< each box's half extent along z */
+    float		*nx;		/*!< the x component of each plane's normal */
+    float		*ny;		/*!< the y component of each plane's normal */
+    float		*nz;		/*!< the z component of each plane's normal */
+    float		*np;		/*!< each plane's normal dotted with its point */
+    Geometry_t		**geometry;	/*!< the geometry object in each slot */
+} Prim_Table_t;
+
+/*! \brief how many slots of each kind a run grouped by Sort_Prims holds */
+typedef struct {
+    int			count[NUM_SLOTS];	/*!< the number of slots of each kind, in Slot_Kind_t order */
+} Prim_Runs_t;
+
+/* !Kind_Prims
+ * \brief which kind of slot an object goes in
+ */
+Slot_Kind_t Kind_Prims(Geometry_t *geometry);
+
+/* !Sort_Prims
+ * \brief group a run of objects by the kind of slot they go in, keeping their order within each kind
+ * \param geometry the objects, sorted in place
+ * \param nGeo the number of objects
+ * \param runs where to write how many objects of each kind there are
+ */
+void Sort_Prims(Geometry_t **geometry, int nGeo, Prim_Runs_t *runs);
+
+/* !Build_Prims
+ * \brief lay out a run of geometry objects in a table
+ * \param geometry the objects, the table keeps them in this order, every run that's tested must be sorted by Sort_Prims
+ * \param nGeo the number of objects
+ */
+Prim_Table_t *Build_Prims(Geometry_t **geometry, int nGeo);
+
+/* !Delete_Prims
+ * \brief free a table, the geometry in it is left alone
+ */
+void Delete_Prims(Prim_Table_t *table);
+
+/* !Kernel_Prims
+ * \brief the name of the sphere kernel the tables are using, for reports
+ */
+const char *Kernel_Prims();
+
+/* !Intersect_Prims
+ * \brief find the closest intersection of a ray with the objects in some slots of a table
+ * \param table the table
+ * \param first the first slot to test
+ * \param runs how many slots of each kind to test, as Sort_Prims found them
+ * \param ray the ray
+ * \param tmax only intersections closer than this are returned
+ * \param dst where to write the t and geo of the closest hit, only touched if there is one, Attributes_Geo fills in the rest
+ * \return whether the ray hit anything
+ */
+bool Intersect_Prims(Prim_Table_t *table, int first, Prim_Runs_t *runs, Rayf_t ray, float tmax, Intersection_t *dst);
+
+/* !Occluded_Prims
+ * \brief whether a ray hits any object in some slots of a table before tmax
+ */
+bool Occluded_Prims(Prim_Table_t *table, int first, Prim_Runs_t *runs, Rayf_t ray, float tmax);
+
+#endif
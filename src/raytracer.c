@@ -1,50 +1,126 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
+#include <unistd.h>
+#include <string.h>
 #include "scene.h"
 #include "objects/geometry.h"
 #include "engine/defs.h"
 #include "engine/image.h"
 #include "engine/parse.h"
+#include "engine/cache.h"
+#include "engine/stats.h"
+
+/* !Usage
+ * \brief print how to run the tracer and quit
+ */
+void Usage(const char *name) {
+    fprintf(stderr, "usage: %s [-t threads] [-s seed] [-f p3|p6] [-T clamp|reinhard] [-c auto|xml|binary] [-S none|text|json] scene.xml\n", name);
+    exit(1);
+}
 
 int main (int argc, char *argv[]) {
-    srand(time(NULL));
-    int i, j;
+    int opt;
+    int nThreads = -1; /* -1 means use whatever the scene file says */
+    char *seed = NULL; /* likewise for NULL */
+    Image_Format_t format = IMAGE_P6;
+    Tonemap_t tonemap = TONEMAP_CLAMP;
+    Cache_Mode_t cache = CACHE_AUTO;
+    Stats_Format_t stats = STATS_TEXT;
+
+    while ((opt = getopt(argc, argv, "t:s:f:T:c:S:")) != -1) {
+	switch (opt) {
+	    case 't':
+		nThreads = atoi(optarg);
+		break;
+	    case 's':
+		seed = optarg;
+		break;
+	    case 'f':
+		if (!strcmp(optarg, "p3"))
+		    format = IMAGE_P3;
+		else if (!strcmp(optarg, "p6"))
+		    format = IMAGE_P6;
+		else
+		    Usage(argv[0]);
+		break;
+	    case 'T':
+		if (!strcmp(optarg, "clamp"))
+		    tonemap = TONEMAP_CLAMP;
+		else if (!strcmp(optarg, "reinhard"))
+		    tonemap = TONEMAP_REINHARD;
+		else
+		    Usage(argv[0]);
+		break;
+	    case 'c':
+		if (!strcmp(optarg, "auto"))
+		    cache = CACHE_AUTO;
+		else if (!strcmp(optarg, "xml"))
+		    cache = CACHE_XML;
+		else if (!strcmp(optarg, "binary"))
+		    cache = CACHE_BINARY;
+		else
+		    Usage(argv[0]);
+		break;
+	    case 'S':
+		if (!strcmp(optarg, "none"))
+		    stats = STATS_NONE;
+		else if (!strcmp(optarg, "text"))
+		    stats = STATS_TEXT;
+		else if (!strcmp(optarg, "json"))
+		    stats = STATS_JSON;
+		else
+		    Usage(argv[0]);
+		break;
+	    default:
+		Usage(argv[0]);
+	}
+    }
 
-    if (argc < 2)
-	assert(0);
+    if (optind >= argc)
+	Usage(argv[0]);
 
     Scene_t *scene;
 
-    scene = Parse_File(argv[1]);
+    TIMER_START(TIMER_PARSE);
+    scene = Load_Scene(argv[optind], cache);
+    TIMER_STOP(TIMER_PARSE);
+    if (!scene)
+	return 1;
     /* scene = Parse_File("../examples/5spheres.xml"); */
+    if (nThreads >= 0)
+	scene->settings->nThreads = nThreads;
+    if (seed != NULL)
+	scene->settings->seed = strtoull(seed, NULL, 10);
+    Prepare_Scene(scene);
 
     if (scene->settings->radiosity) {
-	Calculate_Rex(scene, 1024, scene->settings->rad_accuracy);
+	TIMER_START(TIMER_RADIOSITY);
+	if (scene->settings->rad_mode == RADIOSITY_PHOTONS)
+	    Calculate_Photons(scene, scene->settings->rad_accuracy);
+	else
+	    Calculate_Rex(scene, 1024, scene->settings->rad_accuracy);
+	TIMER_STOP(TIMER_RADIOSITY);
     }
 
     int width = 1024, height = 1024;
-    Color_t *render = Render_Scene(scene, width, height);
-    Image_t *output = New_Image(width, height, render);
+    TIMER_START(TIMER_RENDER);
+    Colorf_t *render = Render_Scene(scene, width, height);
+    TIMER_STOP(TIMER_RENDER);
+
+    TIMER_START(TIMER_TONEMAP);
+    Image_t *output = Tonemap_Image(render, width, height, 1.0f, tonemap);
+    free(render);
+    TIMER_STOP(TIMER_TONEMAP);
 
-    Write_Image(output, "output.ppm");
+    TIMER_START(TIMER_WRITE);
+    Write_Image(output, "output.ppm", format);
+    TIMER_STOP(TIMER_WRITE);
 
     Delete_Image(output);
 
-    /* clean up the memory */
-    for (i = 0; i < scene->nLights; i++)
-	free(scene->light[i]);
-    for (i = 0; i < scene->nGeo; i++) {
-	for (j = 0; j < scene->geometry[i]->diffuse_rex->resolution; j++) {
-	    free(scene->geometry[i]->diffuse_rex->value[i]);
-	    free(scene->geometry[i]->diffuse_rex->vec[i]);
-	    free(scene->geometry[i]->diffuse_rex->nSamples[i]);
-	}
-	free(scene->geometry[i]->diffuse_rex);
-	free(scene->geometry[i]);
-    }
+    Delete_Scene(scene);
 
-    free(scene);
+    Report_Stats(stdout, stats);
 
     return 0;
 }
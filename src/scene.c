@@ -12,10 +12,13 @@
 #include "objects/intersection.h"
 #include "objects/geometry.h"
 #include "engine/vector.h"
+#include "engine/stats.h"
+#include "engine/sampler.h"
 #include "scene.h"
 #include <float.h>
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 
 /* !New_Scene
  * \brief Allocate all the space needed for a scene and set the relevant values
@@ -28,113 +31,382 @@ Scene_t *New_Scene(int nGeo, int nLights) {
     scene->light = NEWVEC(Light_t *, nLights);
     scene->camera = NEW(Camera_t);
     scene->settings = NEW(Settings_t);
+    memset(scene->settings, 0, sizeof(Settings_t));
+    scene->settings->background[3] = 255;
+    scene->settings->packets = true;
+    scene->settings->accel = ACCEL_BVH;
+    scene->settings->nThreads = 0;
+    scene->settings->seed = 0;
+    scene->settings->rex_accum = REX_ATOMIC;
+    scene->settings->light_samples = light_samples_default;
+    scene->settings->ray_cutoff = ray_cutoff_default;
+    scene->settings->roulette = false;
+    scene->settings->aa_base = 1;
+    scene->settings->aa_max = 1;
+    scene->settings->aa_threshold = aa_threshold_default;
+    scene->settings->sampler = SAMPLER_SOBOL;
+    scene->settings->traversal = TRAVERSE_TILES;
+    scene->pool = NULL;
+    scene->bvh = NULL;
+    scene->grid = NULL;
+    scene->nUnbounded = 0;
+    scene->unbounded = NULL;
+    scene->prims = NULL;
+    scene->photons = NULL;
+    scene->lights = NULL;
     return scene;
 }
 
+/* !Delete_Scene
+ * \brief free a scene and everything in it, stopping its threads
+ */
+void Delete_Scene(Scene_t *scene) {
+    int i;
+    for (i = 0; i < scene->nLights; i++)
+	free(scene->light[i]);
+    for (i = 0; i < scene->nGeo; i++) {
+	if (scene->geometry[i]->diffuse_rex)
+	    Delete_Rex(scene->geometry[i]->diffuse_rex);
+	free(scene->geometry[i]->primitive);
+	free(scene->geometry[i]->material);
+	free(scene->geometry[i]->transform);
+	free(scene->geometry[i]);
+    }
+
+    if (scene->bvh)
+	Delete_BVH(scene->bvh);
+    if (scene->grid)
+	Delete_Grid(scene->grid);
+    if (scene->prims)
+	Delete_Prims(scene->prims);
+    if (scene->photons)
+	Delete_Photons(scene->photons);
+    if (scene->lights)
+	Delete_Lights(scene->lights);
+    if (scene->pool)
+	Delete_Pool(scene->pool);
+    free(scene->unbounded);
+    free(scene->geometry);
+    free(scene->light);
+    free(scene->camera);
+    free(scene->settings);
+    free(scene);
+}
+
+/* !Prepare_Scene
+ * \brief compute bounding boxes, build the acceleration structures and start the threads for a scene,
+ * should be called once all the geometry has been read in
+ */
+void Prepare_Scene(Scene_t *scene) {
+    int i, nBounded = 0;
+
+    for (i = 0; i < scene->nGeo; i++) {
+	scene->geometry[i]->id = i;
+	Prepare_Geo(scene->geometry[i]);
+    }
+
+    scene->pool = New_Pool(scene->settings->nThreads);
+
+    /* with only a few lights it's cheaper to shade with all of them than to pick */
+    if (scene->settings->light_samples > 0 && scene->nLights > scene->settings->light_samples)
+	scene->lights = Build_Lights(scene->light, scene->nLights);
+
+    if (scene->settings->accel == ACCEL_NONE) {
+	/* the ids are indices into scene->geometry, so it's a copy that's grouped by kind */
+	Geometry_t **sorted = NEWVEC(Geometry_t *, scene->nGeo);
+	for (i = 0; i < scene->nGeo; i++)
+	    sorted[i] = scene->geometry[i];
+	Sort_Prims(sorted, scene->nGeo, &scene->runs);
+	scene->prims = Build_Prims(sorted, scene->nGeo);
+	free(sorted);
+	return ;
+    }
+
+    Geometry_t **bounded = NEWVEC(Geometry_t *, scene->nGeo);
+
+    scene->nUnbounded = 0;
+    scene->unbounded = NEWVEC(Geometry_t *, scene->nGeo);
+    for (i = 0; i < scene->nGeo; i++) {
+	if (Calculate_Bbox(scene->geometry[i]))
+	    bounded[nBounded++] = scene->geometry[i];
+	else
+	    scene->unbounded[scene->nUnbounded++] = scene->geometry[i];
+    }
+
+    if (scene->settings->accel == ACCEL_GRID)
+	scene->grid = Build_Grid(bounded, nBounded);
+    else
+	scene->bvh = Build_BVH(bounded, nBounded);
+    Sort_Prims(scene->unbounded, scene->nUnbounded, &scene->runs);
+    scene->prims = Build_Prims(scene->unbounded, scene->nUnbounded);
+    free(bounded);
+}
+
 /* !Intersect_Scene
  * \brief intersect a ray with an entire scene.
+ * \param dst where to write the closest intersection, only touched if there is a hit
+ * \return whether the ray hit anything
  */
-Intersection_t *Intersect_Scene(Rayf_t ray, Scene_t *scene) {
-    int i;
+bool Intersect_Scene(Rayf_t ray, Scene_t *scene, Intersection_t *dst) {
     float t_to_beat = FLT_MAX;
-    Intersection_t *candidate = NULL, *answer = NULL;
-    for (i = 0; i < scene->nGeo; i++) {
-	candidate = Intersect_Geo(ray, scene->geometry[i]);
-	if (candidate != NULL) {
-	    if (candidate->t < t_to_beat && candidate->t > EPSILON) {
-		t_to_beat = candidate->t;
-		if (answer != NULL)
-		    free(answer);
-		answer = candidate;
-	    } else {
-		free(candidate);
-	    }
+    bool hit = false;
+
+    if (scene->grid != NULL || scene->bvh != NULL) {
+	if (scene->grid != NULL)
+	    hit = Intersect_Grid(ray, scene->grid, t_to_beat, dst);
+	else
+	    hit = Intersect_BVH(ray, scene->bvh, t_to_beat, dst);
+	if (hit)
+	    t_to_beat = dst->t;
+    }
+
+    /* whatever didn't fit in the acceleration structure still has to be tested one by one */
+    if (Intersect_Prims(scene->prims, 0, &scene->runs, ray, t_to_beat, dst))
+	hit = true;
+
+    /* only the closest hit gets its point, normal and texture coordinates worked out */
+    if (hit)
+	Attributes_Geo(ray, (Geometry_t *) dst->geo, dst->t, dst);
+    return hit;
+}
+
+/* !Occluded_Scene
+ * \brief whether anything in a scene is in the way of a ray before tmax
+ *
+ * unlike Intersect_Scene this stops at the first object it finds rather
+ * than looking for the closest and never fills in an intersection.
+ */
+bool Occluded_Scene(Rayf_t ray, Scene_t *scene, float tmax) {
+    if (scene->grid != NULL && Occluded_Grid(ray, scene->grid, tmax))
+	return true;
+    if (scene->bvh != NULL && Occluded_BVH(ray, scene->bvh, tmax))
+	return true;
+
+    return Occluded_Prims(scene->prims, 0, &scene->runs, ray, tmax);
+}
+
+/* !IntersectPacket_Scene
+ * \brief find which object each ray in a packet hits first
+ * \param packet the rays, their closest hits are written into it
+ * \param scene the scene, which must not be using a grid
+ */
+void IntersectPacket_Scene(Packet_t *packet, Scene_t *scene) {
+    int i, nGeo = scene->nGeo;
+    Geometry_t **geometry = scene->geometry;
+
+    assert(scene->grid == NULL);
+    if (scene->bvh != NULL) {
+	IntersectPacket_BVH(packet, scene->bvh);
+	nGeo = scene->nUnbounded;
+	geometry = scene->unbounded;
+    }
+
+    for (i = 0; i < nGeo; i++)
+	IntersectGeo_Packet(packet, geometry[i]);
+}
+
+/* !Light_Point
+ * \brief add what one light gives a point, if nothing is in the way
+ * \param scene the scene
+ * \param intersection the point being shaded
+ * \param light the light
+ * \param dir the direction the ray was going, normalized in place if it's needed for a highlight
+ * \param weight what to scale the light by
+ * \param intensity where to add the diffuse intensity
+ * \param specIntensity where to add the highlight
+ */
+static void Light_Point(Scene_t *scene, Intersection_t *intersection, Light_t *light, float *dir, float weight,
+	float *intensity, float *specIntensity) {
+    Rayf_t surfToLight;
+    V4f_t norm = LoadV4f(intersection->norm);
+
+    /* compute the lightVec, which is also the direction of the shadow ray */
+    V4f_t lightVec = LoadV4f(light->pos) - LoadV4f(intersection->point);
+    float lightDist = sqrtf(LengthSqV4f(lightVec));
+    NormalizeV4f(&lightVec);
+
+    CopyV3f(intersection->point, surfToLight.orig);
+    StoreV4f(lightVec, surfToLight.dir);
+    STAT_INC(STAT_SHADOW_RAYS);
+
+    /* only things between the surface and the light cast a shadow */
+    if (!Occluded_Scene(surfToLight, scene, lightDist)) {
+	*intensity += Clampf(DotV4f(lightVec, norm)) * light->intensity * weight;
+	if (intersection->material->spec > 0) {
+	    V4f_t LrefdN = ReflectV4f(lightVec, norm); /* the lightVec reflected over the normal */
+
+	    NormalizeV3f(dir);
+	    *specIntensity += pow(Clampf(DotV4f(LrefdN, LoadV4f(dir))), intersection->material->spec) * weight;
 	}
     }
+}
 
-    return answer;
+/* !Shading_Rng
+ * \brief start the stream of random numbers for picking lights at a point
+ *
+ * the stream is named by the bits of the point, so it's the same whichever
+ * thread shades it and however the frame is split up.
+ */
+static void Shading_Rng(Scene_t *scene, Vec3f_t point, uint32_t stream, Rng_t *rng) {
+    uint32_t bits[3];
+    memcpy(bits, point, sizeof(bits));
+    InitRng(rng, scene->settings->seed, bits[0] ^ stream, bits[1], bits[2]);
 }
 
-/* !Trace_Ray
- * \brief shoots a ray into a scene and returns the color of the pixel
+/* !Keep_Ray
+ * \brief decide whether a secondary ray adds enough to the pixel to be worth tracing
+ * \param scene the scene
+ * \param point where the ray starts
+ * \param rng the random numbers for Russian roulette at the point, started the first time they're needed
+ * \param seeded whether rng has been started
+ * \param weight how much of what the ray sees ends up in the pixel, raised to the cutoff if it survives roulette
+ * \param scale what to scale what the ray sees by, 1 unless it survived roulette
+ * \return whether to trace the ray
+ *
+ * rays weighing less than settings->ray_cutoff are dropped, or with
+ * settings->roulette kept with a chance of their weight over the cutoff and
+ * scaled up by one over that chance, which keeps the average right.
  */
-void Trace_Ray(Rayf_t ray, Scene_t *scene, Color_t color, int recursion) {
-    int i;
-    Intersection_t *intersection = Intersect_Scene(ray, scene);
-    if (intersection) {
-	/* compute diffuse value */
-	Rayf_t surfToLight;
-	Vec3f_t lightVec;
-	Color_t diffuse, reflection, transparency, final, spec;
-	float intensity = 0, specIntensity = 0;
-	for (i = 0; i < scene->nLights; i++) {
-	    /* compute the lightVec */
-	    SubV3f(scene->light[i]->pos, intersection->point, lightVec);
-	    NormalizeV3f(lightVec);
-
-	    PointstoRayf(intersection->point, scene->light[i]->pos, &surfToLight);
-
-	    if (!Intersect_Scene(surfToLight, scene)) {
-		intensity += Clampf(DotV3f(lightVec, intersection->norm)) * scene->light[i]->intensity;
-		if (intersection->material->spec > 0) {
-		    Vec3f_t LrefdN; /* the lightVec reflected over the normal */
-		    ReflectV3f(lightVec, intersection->norm, LrefdN);
-
-		    NormalizeV3f(ray.dir);
-		    specIntensity += pow(Clampf(DotV3f(LrefdN, ray.dir)), intersection->material->spec);
-		}
-	    } else {
-		intensity += 0;
-		specIntensity += 0;
-	    }
+static bool Keep_Ray(Scene_t *scene, Vec3f_t point, Rng_t *rng, bool *seeded, float *weight, float *scale) {
+    float cutoff = scene->settings->ray_cutoff;
+    *scale = 1.0f;
+    if (*weight >= cutoff)
+	return true;
+
+    if (scene->settings->roulette) {
+	float survive = *weight / cutoff;
+	if (!*seeded) {
+	    Shading_Rng(scene, point, roulette_rng_stream, rng);
+	    *seeded = true;
+	}
+	if (UniformRng(rng) < survive) {
+	    *scale = 1.0f / survive;
+	    *weight = cutoff;
+	    return true;
 	}
-	intensity /= scene->nLights;
-	specIntensity /= scene->nLights;
+    }
+    STAT_INC(STAT_PRUNED_RAYS);
+    return false;
+}
 
-	if (((Geometry_t *) intersection->geo)->diffuse_rex) {
-	    CatchDiffuse_Rex(((Geometry_t *) intersection->geo)->diffuse_rex, intersection->u, intersection->v, diffuse);
-	} else {
-	    CopyColor(intersection->material->diffuse_color, diffuse);
-	    ScaleColor(diffuse, intensity, diffuse);
+/* !Shade_Ray
+ * \brief work out the color a ray sees at an intersection, tracing whatever secondary rays it needs
+ *
+ * with a light tree only settings->light_samples lights are picked at the
+ * point, each weighted by one over the chance it was picked so the average
+ * is what shading with every light would give.
+ *
+ * weight is how much of the color ends up in the pixel, secondary rays
+ * that would add too little to matter are pruned by Keep_Ray.
+ */
+static void Shade_Ray(Rayf_t ray, Scene_t *scene, Intersection_t *intersection, Colorf_t color, int recursion,
+	float weight) {
+    int i;
+    /* compute diffuse value */
+    Colorf_t diffuse, spec, emission;
+    Colorf_t reflection = {0, 0, 0, 0}, transparency = {0, 0, 0, 0}; /* black unless there's a ray to trace */
+    float intensity = 0, specIntensity = 0;
+    if (scene->lights) {
+	int nSamples = scene->settings->light_samples;
+	Rng_t rng;
+	Shading_Rng(scene, intersection->point, light_rng_stream, &rng);
+	for (i = 0; i < nSamples; i++) {
+	    float pdf;
+	    /* one pick in each of nSamples equal slices of [0, 1) */
+	    Light_t *light = Sample_Lights(scene->lights, intersection->point, intersection->norm,
+		    intersection->material->spec > 0, (i + UniformRng(&rng)) / nSamples, &pdf);
+	    if (light)
+		Light_Point(scene, intersection, light, ray.dir, 1.0f / (nSamples * pdf), &intensity, &specIntensity);
 	}
+    } else {
+	for (i = 0; i < scene->nLights; i++)
+	    Light_Point(scene, intersection, scene->light[i], ray.dir, 1.0f, &intensity, &specIntensity);
+    }
+    intensity /= scene->nLights;
+    specIntensity /= scene->nLights;
+
+    if (((Geometry_t *) intersection->geo)->diffuse_rex) {
+	Color_t caught;
+	CatchDiffuse_Rex(((Geometry_t *) intersection->geo)->diffuse_rex, intersection->u, intersection->v, caught);
+	ColorToColorf(caught, diffuse);
+    } else if (scene->photons) {
+	Gather_Photons(scene->photons, intersection->point, ((Geometry_t *) intersection->geo)->id, diffuse);
+    } else {
+	ColorToColorf(intersection->material->diffuse_color, diffuse);
+	ScaleColorf(diffuse, intensity, diffuse);
+    }
 
-	/* compute reflection value */
-	spec[0] = spec[1] = spec[2] = spec[3] = 255;
-	ScaleColor(spec, specIntensity, spec);
+    /* compute reflection value */
+    spec[0] = spec[1] = spec[2] = spec[3] = specIntensity;
 
-	if (intersection->material->reflection > 0 && recursion > 0) {
-	    Rayf_t reflected_ray;
-	    CopyV3f(intersection->point, reflected_ray.orig);
-	    ReflectV3f(ray.dir, intersection->norm, reflected_ray.dir);
-	    Trace_Ray(reflected_ray, scene, reflection, recursion - 1);
-	}
+    /* each secondary ray's weight is how much of it ends up in the pixel, see the blends below */
+    float reflWeight = weight * intersection->material->reflection;
+    float transpWeight = weight * (1 - intersection->material->reflection) * intersection->material->transparency;
+    float scale;
+    Rng_t rng;
+    bool seeded = false;
 
-	/* compute transparency value */
-	if (intersection->material->transparency > 0) {
-	    Rayf_t refracted_ray;
-	    CopyV3f(intersection->point, refracted_ray.orig);
+    if (intersection->material->reflection > 0 && recursion > 0 &&
+	    Keep_Ray(scene, intersection->point, &rng, &seeded, &reflWeight, &scale)) {
+	Rayf_t reflected_ray;
+	CopyV3f(intersection->point, reflected_ray.orig);
+	StoreV4f(ReflectV4f(LoadV4f(ray.dir), LoadV4f(intersection->norm)), reflected_ray.dir);
+	STAT_INC(STAT_REFLECTION_RAYS);
+	Trace_Ray(reflected_ray, scene, reflection, recursion - 1, reflWeight);
+	if (scale != 1.0f)
+	    ScaleColorf(reflection, scale, reflection);
+    }
 
-	    if (DotV3f(ray.dir, intersection->norm) <= 0) {
-		/* frontside intersection */
-		RefractV3f(ray.dir, intersection->norm, 1.0, intersection->material->refraction, refracted_ray.dir);
-		Trace_Ray(refracted_ray, scene, transparency, recursion - 1);
-	    } else {
-		/* backside intersection */
-		Vec3f_t neg_normal;
-		NegV3f(intersection->norm, neg_normal);
-		RefractV3f(ray.dir, neg_normal, 1.0, intersection->material->refraction, refracted_ray.dir);
-		Trace_Ray(refracted_ray, scene, transparency, recursion - 1);
-	    }
+    /* compute transparency value */
+    if (intersection->material->transparency > 0 &&
+	    Keep_Ray(scene, intersection->point, &rng, &seeded, &transpWeight, &scale)) {
+	Rayf_t refracted_ray;
+	CopyV3f(intersection->point, refracted_ray.orig);
+	STAT_INC(STAT_REFRACTION_RAYS);
+
+	if (DotV3f(ray.dir, intersection->norm) <= 0) {
+	    /* frontside intersection */
+	    RefractV3f(ray.dir, intersection->norm, 1.0, intersection->material->refraction, refracted_ray.dir);
+	    Trace_Ray(refracted_ray, scene, transparency, recursion - 1, transpWeight);
+	} else {
+	    /* backside intersection */
+	    Vec3f_t neg_normal;
+	    NegV3f(intersection->norm, neg_normal);
+	    RefractV3f(ray.dir, neg_normal, 1.0, intersection->material->refraction, refracted_ray.dir);
+	    Trace_Ray(refracted_ray, scene, transparency, recursion - 1, transpWeight);
 	}
-	Color_t emission; /* blending of transparency and diffuse */
-	BlendColor(transparency, diffuse, intersection->material->transparency, emission);
-	BlendColor(reflection, emission, intersection->material->reflection, final);
-	CopyColor(emission, color);
-	SaturatedAddColor(final, spec, final);
-	CopyColor(final, color);
-	free(intersection);
-    } else
-	CopyColor(scene->settings->background, color);
+	if (scale != 1.0f)
+	    ScaleColorf(transparency, scale, transparency);
+    }
+
+    /* blend transparency into diffuse, then reflection into that, and add the highlight on top */
+    BlendColorf(transparency, diffuse, intersection->material->transparency, emission);
+    BlendColorf(reflection, emission, intersection->material->reflection, color);
+    AddColorf(color, spec, color);
+}
+
+/* !Trace_Ray
+ * \brief shoots a ray into a scene and returns the radiance it sees
+ * \param ray the ray
+ * \param scene the scene
+ * \param color where to write the radiance
+ * \param recursion how many more times the ray may be reflected
+ * \param weight how much of the radiance ends up in the pixel, 1 for a primary ray
+ */
+void Trace_Ray(Rayf_t ray, Scene_t *scene, Colorf_t color, int recursion, float weight) {
+    Intersection_t hit;
+    if (Intersect_Scene(ray, scene, &hit))
+	Shade_Ray(ray, scene, &hit, color, recursion, weight);
+    else
+	ColorToColorf(scene->settings->background, color);
+}
+
+/* !Sampler_Seed
+ * \brief the seed that scrambles the sample points for something in a scene, e.g. the rays from a light
+ */
+static uint32_t Sampler_Seed(Scene_t *scene, uint32_t a, uint32_t b) {
+    uint64_t seed = scene->settings->seed;
+    return HashSampler(HashSampler(HashSampler((uint32_t) seed, (uint32_t) (seed >> 32)), a), b);
 }
 
 /* !ThrowRay_Scene
@@ -145,14 +417,17 @@ void Trace_Ray(Rayf_t ray, Scene_t *scene, Color_t color, int recursion) {
  * \param lIndex the index of the light the ray is from
  * \param recursion how many times to let the rays bounce
  * \param cascade how many ray to make
+ * \param rexes the rexes to throw into, indexed by object id
+ * \param rng the random numbers for the light ray this one descends from
  */
-void ThrowRay_Scene(Scene_t *scene, Rayf_t ray, Color_t color, int recursion, int cascade) {
+void ThrowRay_Scene(Scene_t *scene, Rayf_t ray, Color_t color, int recursion, int cascade, Rex_t **rexes, Rng_t *rng) {
     int i;
     if (recursion < 1)
 	return ;
 
-    Intersection_t *intersection = Intersect_Scene(ray, scene);
-    if (intersection) {
+    STAT_INC(STAT_RADIOSITY_RAYS);
+    Intersection_t hit, *intersection = &hit;
+    if (Intersect_Scene(ray, scene, intersection)) {
 	Vec3f_t lightVec;
 	NegV3f(ray.dir, lightVec);
 
@@ -164,7 +439,7 @@ void ThrowRay_Scene(Scene_t *scene, Rayf_t ray, Color_t color, int recursion, in
 	Vec3f_t spec_dir;
 	ReflectV3f(ray.dir, intersection->norm, spec_dir);
 
-	ThrowDiffuse_Rex(( (Geometry_t *) intersection->geo)->diffuse_rex, intersection->u, intersection->v, diffuse_color);
+	ThrowDiffuse_Rex(rexes[((Geometry_t *) intersection->geo)->id], intersection->u, intersection->v, diffuse_color);
 
 	/* Cascade the ray */
 	Vec3f_t diffuse_dir; /* directions in which diffuse and spec are maximal */
@@ -174,11 +449,17 @@ void ThrowRay_Scene(Scene_t *scene, Rayf_t ray, Color_t color, int recursion, in
 
 	Rayf_t bounceRay;
 	CopyV3f(intersection->point, bounceRay.orig);
+
+	/* the cascade's directions are the first points of a sequence of their own, so they're spread evenly */
+	Sampler_Type_t type = scene->settings->sampler;
+	uint32_t seed = type == SAMPLER_RANDOM ? 0 : NextRng(rng);
 	for (i = 0; i < cascade; i++) {
 	    Vec3f_t bounceVec;
+	    Sampler_t sampler;
 	    
+	    InitSampler(&sampler, type, i, seed, rng);
 	    CopyV3f(intersection->norm, bounceVec);
-	    PerturbV3f(bounceVec, .5, bounceVec);
+	    PerturbSampleV3f(&sampler, bounceVec, .5, bounceVec);
 	    NormalizeV3f(bounceVec);
 	    CopyV3f(bounceVec, bounceRay.dir);
 
@@ -186,101 +467,714 @@ void ThrowRay_Scene(Scene_t *scene, Rayf_t ray, Color_t color, int recursion, in
 	    CopyColor(color, spec_color);
 	    ScaleColor(spec_color, pow(Clampf(DotV3f(spec_dir, bounceVec)), intersection->material->spec), spec_color);
 
-	    ThrowRay_Scene(scene, bounceRay, spec_color, recursion - 1, cascade);
-	    ThrowRay_Scene(scene, bounceRay, diffuse_color, recursion - 1, cascade);
+	    ThrowRay_Scene(scene, bounceRay, spec_color, recursion - 1, cascade, rexes, rng);
+	    ThrowRay_Scene(scene, bounceRay, diffuse_color, recursion - 1, cascade, rexes, rng);
 
 	}
-	free(intersection);
     }
 }
 
+/*! \brief everything the workers need to throw light rays into a scene */
+typedef struct {
+    Scene_t		*scene;		/*!< the scene */
+    int			accuracy;	/*!< how many rays each light throws */
+    int			nBatches;	/*!< how many tasks the rays are split into */
+    Rex_t		***rexes;	/*!< the rexes each worker throws into, indexed by worker then object id */
+    int			done;		/*!< how many batches are finished */
+} Rex_Job_t;
+
+/* !Throw_Batch
+ * \brief throw one batch of light rays into a scene, run by the pool
+ */
+static void Throw_Batch(void *arg, int batch, int worker) {
+    Rex_Job_t *job = (Rex_Job_t *) arg;
+    Scene_t *scene = job->scene;
+    long k, nRays = (long) scene->nLights * job->accuracy;
+    long first = nRays * batch / job->nBatches, last = nRays * (batch + 1) / job->nBatches;
+
+    for (k = first; k < last; k++) {
+	int i = k / job->accuracy, j = k % job->accuracy;
+
+	/* every light ray gets its own stream so it comes out the same whoever traces it */
+	Rng_t rng;
+	InitRng(&rng, scene->settings->seed, i, j, 0);
+
+	/* and the jth point of the light's sequence for its direction */
+	Sampler_t sampler;
+	InitSampler(&sampler, scene->settings->sampler, j, Sampler_Seed(scene, i, 0), &rng);
+
+	Rayf_t lightRay;
+	PointstoRayf(scene->light[i]->pos, scene->light[i]->look_at, &lightRay);
+	PerturbSampleV3f(&sampler, lightRay.dir, rex_perturb, lightRay.dir);
+
+	/* shoot the ray */
+	Color_t lightColor = {255, 255, 255, 255};
+	ScaleColor(lightColor, scene->light[i]->intensity, lightColor);
+	ThrowRay_Scene(scene, lightRay, lightColor, 2, 10, job->rexes[worker], &rng);
+    }
+
+    int done = __atomic_add_fetch(&job->done, 1, __ATOMIC_RELAXED);
+    if (done * 100 / job->nBatches != (done - 1) * 100 / job->nBatches)
+	printf("Completion: %f\n", (float) done / job->nBatches);
+}
+
+/* !Reduce_Page
+ * \brief merge every worker's light into one page of an object's rex and average it, run by the pool
+ */
+static void Reduce_Page(void *arg, int task, int worker) {
+    Rex_Job_t *job = (Rex_Job_t *) arg;
+    Scene_t *scene = job->scene;
+    int w, id = task / Pages_Rex(scene->geometry[0]->diffuse_rex);
+    int page = task % Pages_Rex(scene->geometry[0]->diffuse_rex);
+    Rex_t *rex = scene->geometry[id]->diffuse_rex;
+
+    /* worker 0 always throws straight into the scene's rexes */
+    if (scene->settings->rex_accum == REX_PARTIAL)
+	for (w = 1; w < scene->pool->nThreads; w++)
+	    Merge_Rex(rex, job->rexes[w][id], page);
+    Resolve_Rex(rex, page);
+}
+
 /* !Calculate_Rex
  * \brief Use monte-carlo technique to compute each surfaces illumination
  * \param scene the scene we're computing rexes for
  * \param resolution the resolution of the scene
  * \param accuracy how many rays to use in calculating the illumination
+ *
+ * the light rays are split into batches for the scene's pool. the workers
+ * either all add into the same rexes atomically or each get rexes of their
+ * own which are summed at the end, depending on the scene's settings. the
+ * rexes keep plain sums so both give the same answer.
  */
 void Calculate_Rex(Scene_t *scene, int resolution, int accuracy) {
-    int i, j;
+    int i, w, nThreads = scene->pool->nThreads;
+    bool partial = scene->settings->rex_accum == REX_PARTIAL;
+    double start = GetTime();
+    Rex_Job_t job;
+
+    if (scene->nGeo == 0)
+	return ;
 
     /* allocate the rexes */
     for (i = 0; i < scene->nGeo; i++) {
 	scene->geometry[i]->diffuse_rex = NEW(Rex_t);
-	Init_Rex(scene->geometry[i]->diffuse_rex, resolution);
+	Init_Rex(scene->geometry[i]->diffuse_rex, resolution, false);
+	scene->geometry[i]->diffuse_rex->shared = !partial && nThreads > 1;
+    }
+
+    job.scene = scene;
+    job.accuracy = accuracy;
+    job.nBatches = ((long) scene->nLights * accuracy + rex_batch_size - 1) / rex_batch_size;
+    job.done = 0;
+    job.rexes = NEWVEC(Rex_t **, nThreads);
+    for (w = 0; w < nThreads; w++) {
+	job.rexes[w] = NEWVEC(Rex_t *, scene->nGeo);
+	for (i = 0; i < scene->nGeo; i++) {
+	    if (partial && w > 0) {
+		job.rexes[w][i] = NEW(Rex_t);
+		Init_Rex(job.rexes[w][i], resolution, false);
+	    } else {
+		job.rexes[w][i] = scene->geometry[i]->diffuse_rex;
+	    }
+	}
+    }
+
+    Run_Pool(scene->pool, job.nBatches, Throw_Batch, &job);
+    Run_Pool(scene->pool, scene->nGeo * Pages_Rex(scene->geometry[0]->diffuse_rex), Reduce_Page, &job);
+
+    for (w = 0; w < nThreads; w++) {
+	for (i = 0; i < scene->nGeo; i++) {
+	    if (partial && w > 0)
+		Delete_Rex(job.rexes[w][i]);
+	    else
+		job.rexes[w][i]->shared = false;
+	}
+	free(job.rexes[w]);
+    }
+    free(job.rexes);
+
+    size_t size = 0;
+    for (i = 0; i < scene->nGeo; i++)
+	size += Size_Rex(scene->geometry[i]->diffuse_rex);
+
+    printf("Radiosity took %f seconds with %d threads (%s accumulation)\n", GetTime() - start, nThreads,
+	    partial ? "partial" : "atomic");
+    printf("Rexes are using %.1f MB\n", size / (1024.0 * 1024.0));
+}
+
+/*! \brief everything the workers need to trace photons into a scene */
+typedef struct {
+    Scene_t		*scene;		/*!< the scene */
+    int			accuracy;	/*!< how many photons each light sends out */
+    int			nBatches;	/*!< how many tasks the photons are split into */
+    Photon_t		**stored;	/*!< the photons each batch left behind */
+    int			*nStored;	/*!< how many photons each batch left behind */
+} Photon_Job_t;
+
+/* !Trace_Photon
+ * \brief follow one photon through a scene, storing it at every surface it lands on
+ * \param dst where to store the photons, there's room for photon_max_bounces
+ * \return how many photons were stored
+ */
+static int Trace_Photon(Scene_t *scene, Rayf_t ray, Colorf_t power, Sampler_t *sampler, Photon_t *dst) {
+    int k, n = 0;
+    Intersection_t hit;
+
+    while (n < photon_max_bounces) {
+	STAT_INC(STAT_RADIOSITY_RAYS);
+	if (!Intersect_Scene(ray, scene, &hit))
+	    break;
+
+	/* the light the surface reflects diffusely, just what ThrowRay_Scene throws into a rex */
+	Vec3f_t lightVec;
+	Colorf_t surface, diffuse;
+	NegV3f(ray.dir, lightVec);
+	ColorToColorf(hit.material->diffuse_color, surface);
+	for (k = 0; k < 3; k++)
+	    diffuse[k] = power[k] * surface[k];
+	ScaleColorf(diffuse, Clampf(DotV3f(lightVec, hit.norm)), diffuse);
+
+	CopyV3f(hit.point, dst[n].pos);
+	CopyV3f(diffuse, dst[n].power);
+	dst[n].id = ((Geometry_t *) hit.geo)->id;
+	n++;
+
+	/* Russian roulette, the photon survives with the chance its light does */
+	float before = Maxf(power[0], Maxf(power[1], power[2]));
+	float survive = before > 0 ? Clampf(Maxf(diffuse[0], Maxf(diffuse[1], diffuse[2])) / before) : 0;
+	if (survive <= 0 || NextSampler(sampler) >= survive)
+	    break;
+	ScaleColorf(diffuse, 1 / survive, power);
+
+	/* and bounces off in a random direction about the normal like a cascaded light ray */
+	CopyV3f(hit.point, ray.orig);
+	PerturbSampleV3f(sampler, hit.norm, .5, ray.dir);
+	NormalizeV3f(ray.dir);
+    }
+
+    return n;
+}
+
+/* !Photon_Batch
+ * \brief trace one batch of photons into a scene, run by the pool
+ */
+static void Photon_Batch(void *arg, int batch, int worker) {
+    Photon_Job_t *job = (Photon_Job_t *) arg;
+    Scene_t *scene = job->scene;
+    long k, nRays = (long) scene->nLights * job->accuracy;
+    long first = nRays * batch / job->nBatches, last = nRays * (batch + 1) / job->nBatches;
+    Photon_t *stored = NEWVEC(Photon_t, (last - first) * photon_max_bounces);
+    int n = 0;
+
+    for (k = first; k < last; k++) {
+	int i = k / job->accuracy, j = k % job->accuracy;
+
+	/* every photon gets its own stream so it comes out the same whoever traces it */
+	Rng_t rng;
+	InitRng(&rng, scene->settings->seed, i, j, 0);
+
+	/* and the jth point of the light's sequence for every choice along its path */
+	Sampler_t sampler;
+	InitSampler(&sampler, scene->settings->sampler, j, Sampler_Seed(scene, i, 1), &rng);
+
+	Rayf_t lightRay;
+	PointstoRayf(scene->light[i]->pos, scene->light[i]->look_at, &lightRay);
+	PerturbSampleV3f(&sampler, lightRay.dir, rex_perturb, lightRay.dir);
+
+	Colorf_t power = {1, 1, 1, 1};
+	ScaleColorf(power, scene->light[i]->intensity, power);
+	n += Trace_Photon(scene, lightRay, power, &sampler, stored + n);
+    }
+
+    /* only keep as much room as the batch used */
+    job->stored[batch] = NEWVEC(Photon_t, n > 0 ? n : 1);
+    memcpy(job->stored[batch], stored, sizeof(Photon_t) * n);
+    job->nStored[batch] = n;
+    free(stored);
+}
+
+/* !Calculate_Photons
+ * \brief trace photons from every light and gather them into the scene's photon map
+ * \param scene the scene
+ * \param accuracy how many photons each light sends out
+ *
+ * each photon follows a single path, at every surface it hits it leaves
+ * behind the light that surface reflects diffusely and carries on with it
+ * in a random direction about the normal. Russian roulette stops the path
+ * with the chance that the light is absorbed, and scales up the photons
+ * that survive to make up for it.
+ */
+void Calculate_Photons(Scene_t *scene, int accuracy) {
+    int b, n = 0;
+    double start = GetTime();
+    Photon_Job_t job;
+
+    if (scene->nGeo == 0)
+	return ;
+
+    job.scene = scene;
+    job.accuracy = accuracy;
+    job.nBatches = ((long) scene->nLights * accuracy + rex_batch_size - 1) / rex_batch_size;
+    job.stored = NEWVEC(Photon_t *, job.nBatches);
+    job.nStored = NEWVEC(int, job.nBatches);
+
+    Run_Pool(scene->pool, job.nBatches, Photon_Batch, &job);
+
+    /* the batches are put together in order so the map doesn't depend on who traced what */
+    for (b = 0; b < job.nBatches; b++)
+	n += job.nStored[b];
+    Photon_t *photons = NEWVEC(Photon_t, n > 0 ? n : 1);
+    for (b = 0, n = 0; b < job.nBatches; b++) {
+	memcpy(photons + n, job.stored[b], sizeof(Photon_t) * job.nStored[b]);
+	n += job.nStored[b];
+	free(job.stored[b]);
+    }
+    free(job.stored);
+    free(job.nStored);
+
+    scene->photons = Build_Photons(photons, n, scene->nGeo);
+
+    printf("Photon map took %f seconds with %d threads\n", GetTime() - start, scene->pool->nThreads);
+    printf("%d photons are using %.1f MB\n", n, n * sizeof(Photon_t) / (1024.0 * 1024.0));
+}
+
+/*! \brief what's been seen through a pixel while sampling it adaptively */
+typedef struct {
+    Rng_t		rng;		/*!< where the samples in the pixel go */
+    uint32_t		seed;		/*!< scrambles the pixel's sequence of sample positions */
+    int			n;		/*!< how many samples have been taken */
+    float		lum;		/*!< the sum of their luminances */
+    float		lumSq;		/*!< the sum of their squared luminances */
+} Pixel_Samples_t;
+
+/*! \brief everything the workers need to render a frame */
+typedef struct {
+    Scene_t		*scene;		/*!< the scene being rendered */
+    Colorf_t		*render;	/*!< the radiance summed into each pixel, a tile after another, see Frame_Pixel */
+    int			wres;		/*!< width resolution */
+    int			hres;		/*!< height resolution */
+    int			tileW;		/*!< the width of a tile */
+    int			tileH;		/*!< the height of a tile */
+    int			wTiles;		/*!< how many tiles there are along the width */
+    int			*tileOrder;	/*!< the tiles in the order they're handed to the pool */
+    int			wBlocks;	/*!< how many packet_width blocks there are along the width of a tile */
+    int			nBlocks;	/*!< how many blocks there are in a tile */
+    int			*blockOrder;	/*!< the blocks of a tile in the order they're traced */
+    Vec3f_t		woffset;	/*!< the distance between pixels along the width */
+    Vec3f_t		hoffset;	/*!< the distance between pixels along the height */
+    Vec3f_t		centerScreenPos; /*!< the position of the center of the screen */
+    bool		packets;	/*!< whether to trace primary rays in packets */
+    int			base;		/*!< how many samples every pixel gets */
+    int			max;		/*!< the most samples any pixel gets, 1 for a single ray through each center */
+    int			strata;		/*!< the samples in a pixel are spread over a strata by strata grid */
+    Pixel_Samples_t	*pixels;	/*!< a tile of adaptive sampling state for each worker, worker w's starts at w * tileW * tileH */
+} Render_Job_t;
+
+/* !Primary_Ray
+ * \brief set up the ray from the camera through a pixel
+ * \param dx how far across the pixel to aim from its center, in pixels
+ * \param dy how far down the pixel to aim from its center, in pixels
+ */
+static void Primary_Ray(Render_Job_t *job, int i, int j, float dx, float dy, Rayf_t *ray) {
+    V4f_t orig = LoadV4f(job->scene->camera->pos);
+    float x = (i - (job->wres / 2)) + dx, y = (j - (job->hres / 2)) + dy;
+
+    /* the position on the screen that the ray passes through */
+    V4f_t screenPos = LoadV4f(job->centerScreenPos) + x * LoadV4f(job->woffset);
+    screenPos = screenPos + y * LoadV4f(job->hoffset);
+
+    V4f_t dir = screenPos - orig;
+    NormalizeV4f(&dir);
+    StoreV4f(orig, ray->orig);
+    StoreV4f(dir, ray->dir);
+}
+
+/* !Frame_Pixel
+ * \brief where a pixel is in the frame
+ *
+ * the frame is kept a tile at a time, each tile's pixels row by row, so
+ * everything a worker writes while it's on a tile is in one run of memory.
+ */
+static inline Colorf_t *Frame_Pixel(Render_Job_t *job, int i, int j) {
+    int tile = i / job->tileW + job->wTiles * (j / job->tileH);
+    return &job->render[tile * job->tileW * job->tileH + (j % job->tileH) * job->tileW + i % job->tileW];
+}
+
+/* !Accumulate_Pixel
+ * \brief add a sample's radiance into a pixel of the frame
+ */
+static inline void Accumulate_Pixel(Render_Job_t *job, int i, int j, Colorf_t sample) {
+    Colorf_t *pixel = Frame_Pixel(job, i, j);
+    AddColorf(*pixel, sample, *pixel);
+}
+
+/* !Block_Origin
+ * \brief the top left pixel of the bth block traced in a tile
+ * \return false if the block is past the edge of the frame
+ */
+static inline bool Block_Origin(Render_Job_t *job, int b, int i0, int j0, int i1, int j1, int *bi, int *bj) {
+    *bi = i0 + (job->blockOrder[b] % job->wBlocks) * packet_width;
+    *bj = j0 + (job->blockOrder[b] / job->wBlocks) * packet_width;
+    return *bi < i1 && *bj < j1;
+}
+
+/* !Render_Packet
+ * \brief render a packet_width square block of pixels with a packet of primary rays
+ * \param offset where in each pixel to aim as in Primary_Ray, NULL for the centers
+ * \param samples where to write the radiance each ray sees
+ *
+ * the packet only finds what each ray hits, the shading and every
+ * secondary ray after it is traced a ray at a time.
+ */
+static void Render_Packet(Render_Job_t *job, int i0, int j0, float offset[packet_size][2], Colorf_t samples[packet_size]) {
+    Scene_t *scene = job->scene;
+    int k;
+    Rayf_t ray;
+    Vec3f_t dirs[packet_size];
+    Packet_t packet;
+
+    for (k = 0; k < packet_size; k++) {
+	Primary_Ray(job, i0 + k % packet_width, j0 + k / packet_width,
+		offset ? offset[k][0] : 0, offset ? offset[k][1] : 0, &ray);
+	CopyV3f(ray.dir, dirs[k]);
+    }
+    Init_Packet(&packet, ray.orig, dirs);
+    IntersectPacket_Scene(&packet, scene);
+
+    for (k = 0; k < packet_size; k++) {
+	Intersection_t hit;
+
+	STAT_INC(STAT_PRIMARY_RAYS);
+	Ray_Packet(&packet, k, &ray);
+	if (packet.hit[k] && Intersect_Geo(ray, packet.hit[k], &hit))
+	    Shade_Ray(ray, scene, &hit, samples[k], 10, 1.0f);
+	else
+	    ColorToColorf(scene->settings->background, samples[k]);
+    }
+}
+
+/* !Offset_Sample
+ * \brief where in a pixel to aim its kth sample
+ *
+ * with random sampling the pixel is cut into a grid of job->strata by
+ * job->strata cells and the samples go through the cells in turn at a
+ * random spot in each, otherwise the kth sample is the kth point of the
+ * pixel's sequence.
+ */
+static void Offset_Sample(Render_Job_t *job, Pixel_Samples_t *pixel, int k, float offset[2]) {
+    if (job->scene->settings->sampler != SAMPLER_RANDOM) {
+	Sampler_t sampler;
+	InitSampler(&sampler, job->scene->settings->sampler, k, pixel->seed, &pixel->rng);
+	offset[0] = NextSampler(&sampler) - 0.5f;
+	offset[1] = NextSampler(&sampler) - 0.5f;
+	return ;
+    }
+
+    int cell = k % (job->strata * job->strata);
+    offset[0] = (cell % job->strata + UniformRng(&pixel->rng)) / job->strata - 0.5f;
+    offset[1] = (cell / job->strata + UniformRng(&pixel->rng)) / job->strata - 0.5f;
+}
+
+/* !Add_Sample
+ * \brief add a sample to a pixel of the frame and to the pixel's running luminance
+ */
+static void Add_Sample(Render_Job_t *job, Pixel_Samples_t *pixel, int i, int j, Colorf_t sample) {
+    /* what the display can show is what matters, a highlight far past white shouldn't keep asking for samples */
+    float lum = 0.2126f * Clampf(sample[0]) + 0.7152f * Clampf(sample[1]) + 0.0722f * Clampf(sample[2]);
+    Accumulate_Pixel(job, i, j, sample);
+    pixel->n++;
+    pixel->lum += lum;
+    pixel->lumSq += lum * lum;
+}
+
+/* !Error_Pixel
+ * \brief the standard error of the mean luminance of a pixel, how far off the pixel is likely to be
+ */
+static float Error_Pixel(Pixel_Samples_t *pixel) {
+    if (pixel->n < 2)
+	return FLT_MAX;
+    float mean = pixel->lum / pixel->n;
+    float var = Maxf(pixel->lumSq / pixel->n - mean * mean, 0) * pixel->n / (pixel->n - 1);
+    return sqrtf(var / pixel->n);
+}
+
+/* !Sample_Pixel
+ * \brief trace one more sample through a pixel
+ */
+static void Sample_Pixel(Render_Job_t *job, Pixel_Samples_t *pixel, int i, int j) {
+    Rayf_t ray;
+    Colorf_t sample;
+    float offset[2];
+    Offset_Sample(job, pixel, pixel->n, offset);
+    Primary_Ray(job, i, j, offset[0], offset[1], &ray);
+    STAT_INC(STAT_PRIMARY_RAYS);
+    Trace_Ray(ray, job->scene, sample, 10, 1.0f);
+    Add_Sample(job, pixel, i, j, sample);
+}
+
+/* !Render_Adaptive
+ * \brief render the pixels of a tile with as many samples as each one needs
+ *
+ * every pixel first gets job->base samples, a packet_width square block
+ * at a time through packets where it can. then each pixel whose error is
+ * still above settings->aa_threshold gets one sample at a time until it
+ * isn't or it's had job->max. the frame is left holding the average of
+ * each pixel's samples.
+ * \param worker the worker running it, whose tile of job->pixels it keeps the samples in
+ */
+static void Render_Adaptive(Render_Job_t *job, int worker, int i0, int j0, int i1, int j1) {
+    Scene_t *scene = job->scene;
+    int i, j, k, s, b, bi, bj;
+    Pixel_Samples_t *pixels = job->pixels + (size_t) worker * job->tileW * job->tileH;
+    float threshold = scene->settings->aa_threshold;
+
+#define TILE_PIXEL(i, j)	(&pixels[((i) - i0) + job->tileW * ((j) - j0)])
+
+    for (j = j0; j < j1; j++) {
+	for (i = i0; i < i1; i++) {
+	    Pixel_Samples_t *pixel = TILE_PIXEL(i, j);
+	    InitRng(&pixel->rng, scene->settings->seed, i, j, aa_rng_stream);
+	    pixel->seed = Sampler_Seed(scene, i, j);
+	    pixel->n = 0;
+	    pixel->lum = pixel->lumSq = 0;
+	}
     }
 
-    float step = .01;
-    float percent_complete;
-    for (i = 0; i < scene->nLights; i++) {
-	for (j = 0; j < accuracy; j++) {
-	    if ((float) j / accuracy - step > percent_complete) {
-		percent_complete += step;
-		printf("Completion: %f\n", percent_complete);
+    for (s = 0; s < job->base; s++) {
+	for (b = 0; b < job->nBlocks; b++) {
+	    if (!Block_Origin(job, b, i0, j0, i1, j1, &bi, &bj))
+		continue;
+	    if (job->packets && bi + packet_width <= i1 && bj + packet_width <= j1) {
+		float offset[packet_size][2];
+		Colorf_t samples[packet_size];
+		for (k = 0; k < packet_size; k++)
+		    Offset_Sample(job, TILE_PIXEL(bi + k % packet_width, bj + k / packet_width), s, offset[k]);
+		Render_Packet(job, bi, bj, offset, samples);
+		for (k = 0; k < packet_size; k++)
+		    Add_Sample(job, TILE_PIXEL(bi + k % packet_width, bj + k / packet_width),
+			    bi + k % packet_width, bj + k / packet_width, samples[k]);
+		continue;
 	    }
-	    Rayf_t lightRay;
-	    PointstoRayf(scene->light[i]->pos, scene->light[i]->look_at, &lightRay);
-	    PerturbV3f(lightRay.dir, rex_perturb, lightRay.dir);
-
-	    /* shoot the ray */
-	    Color_t lightColor = {255, 255, 255, 255};
-	    ScaleColor(lightColor, scene->light[i]->intensity, lightColor);
-	    ThrowRay_Scene(scene, lightRay, lightColor, 2, 10);
+
+	    for (j = bj; j < bj + packet_width && j < j1; j++)
+		for (i = bi; i < bi + packet_width && i < i1; i++)
+		    Sample_Pixel(job, TILE_PIXEL(i, j), i, j);
+	}
+    }
+
+    for (j = j0; j < j1; j++) {
+	for (i = i0; i < i1; i++) {
+	    Pixel_Samples_t *pixel = TILE_PIXEL(i, j);
+	    while (pixel->n < job->max && Error_Pixel(pixel) > threshold) {
+		STAT_INC(STAT_ADAPTIVE_SAMPLES);
+		Sample_Pixel(job, pixel, i, j);
+	    }
+	    Colorf_t *sum = Frame_Pixel(job, i, j);
+	    ScaleColorf(*sum, 1.0f / pixel->n, *sum);
 	}
     }
+
+#undef TILE_PIXEL
+}
+
+/* !Render_Tile
+ * \brief render the indexth tile of a frame in the job's order, run by the pool
+ */
+static void Render_Tile(void *arg, int index, int worker) {
+    Render_Job_t *job = (Render_Job_t *) arg;
+    Scene_t *scene = job->scene;
+    int i, j, k, b, bi, bj, tile = job->tileOrder[index];
+    int i0 = (tile % job->wTiles) * job->tileW, j0 = (tile / job->wTiles) * job->tileH;
+    int i1 = i0 + job->tileW, j1 = j0 + job->tileH;
+    if (i1 > job->wres)
+	i1 = job->wres;
+    if (j1 > job->hres)
+	j1 = job->hres;
+
+    if (job->max > 1) {
+	Render_Adaptive(job, worker, i0, j0, i1, j1);
+	return ;
+    }
+
+    Rayf_t ray; /* the ray we'll shoot into the scene */
+
+    /* go through the tile a packet_width square block at a time, blocks cut off by the edge of the frame get single rays */
+    for (b = 0; b < job->nBlocks; b++) {
+	if (!Block_Origin(job, b, i0, j0, i1, j1, &bi, &bj))
+	    continue;
+	if (job->packets && bi + packet_width <= i1 && bj + packet_width <= j1) {
+	    Colorf_t samples[packet_size];
+	    Render_Packet(job, bi, bj, NULL, samples);
+	    for (k = 0; k < packet_size; k++)
+		Accumulate_Pixel(job, bi + k % packet_width, bj + k / packet_width, samples[k]);
+	    continue;
+	}
+
+	for (j = bj; j < bj + packet_width && j < j1; j++) {
+	    for (i = bi; i < bi + packet_width && i < i1; i++) {
+		Colorf_t sample;
+		Primary_Ray(job, i, j, 0, 0, &ray);
+		STAT_INC(STAT_PRIMARY_RAYS);
+		Trace_Ray(ray, scene, sample, 10, 1.0f);
+		Accumulate_Pixel(job, i, j, sample);
+	    }
+	}
+    }
+}
+
+/* !Morton_Point
+ * \brief the point d steps along a Z-order curve
+ */
+static void Morton_Point(int d, int *x, int *y) {
+    int bit;
+    *x = *y = 0;
+    for (bit = 0; d >> (2 * bit); bit++) {
+	*x |= ((d >> (2 * bit)) & 1) << bit;
+	*y |= ((d >> (2 * bit + 1)) & 1) << bit;
+    }
+}
+
+/* !Hilbert_Point
+ * \brief the point d steps along a Hilbert curve filling an n by n square, n a power of 2
+ */
+static void Hilbert_Point(int n, int d, int *x, int *y) {
+    int s, rx, ry, t;
+    *x = *y = 0;
+    for (s = 1; s < n; s *= 2) {
+	rx = 1 & (d / 2);
+	ry = 1 & (d ^ rx);
+	/* rotate the quadrant so the curve joins up */
+	if (ry == 0) {
+	    if (rx == 1) {
+		*x = s - 1 - *x;
+		*y = s - 1 - *y;
+	    }
+	    t = *x;
+	    *x = *y;
+	    *y = t;
+	}
+	*x += s * rx;
+	*y += s * ry;
+	d /= 4;
+    }
+}
+
+/* !Curve_Order
+ * \brief the cells of a w by h grid, as x + w * y, in the order a traversal visits them
+ *
+ * the curves are laid over the smallest power of 2 square that covers the
+ * grid and the cells off the grid are skipped.
+ */
+static int *Curve_Order(Traversal_t traversal, int w, int h) {
+    int d, x, y, n = 1, count = 0;
+    int *order = NEWVEC(int, w * h);
+
+    if (traversal != TRAVERSE_MORTON && traversal != TRAVERSE_HILBERT) {
+	for (d = 0; d < w * h; d++)
+	    order[d] = d;
+	return order;
+    }
+
+    while (n < w || n < h)
+	n *= 2;
+    for (d = 0; d < n * n; d++) {
+	if (traversal == TRAVERSE_MORTON)
+	    Morton_Point(d, &x, &y);
+	else
+	    Hilbert_Point(n, d, &x, &y);
+	if (x < w && y < h)
+	    order[count++] = x + w * y;
+    }
+    assert(count == w * h);
+    return order;
 }
 
 /* !Render_Scene
- * \brief Shoots rays in to a scene to evaluate their color and returns them as an hres by vres array
+ * \brief Shoots rays in to a scene and returns the radiance they see as an hres by vres array
  * \param scene the scene to be rendered
- * \param wres width resolution (
-should be a power of 2)
+ * \param wres width resolution (should be a power of 2)
  * \param hres height resolution (should be a power of 2)
+ *
+ * the frame is cut into tiles which the scene's pool works through, idle
+ * workers steal tiles from busy ones so expensive regions get shared out.
+ * samples are summed into the frame in floating point, nothing is rounded
+ * to 8 bits until the frame goes through Tonemap_Image.
  */
-Color_t *Render_Scene(Scene_t *scene, int wres, int hres) {
+Colorf_t *Render_Scene(Scene_t *scene, int wres, int hres) {
     int i, j;
-    Color_t *render = NEWVEC(Color_t, wres * hres);
+    Render_Job_t job;
+    job.scene = scene;
+    job.wres = wres;
+    job.hres = hres;
+    assert(wres % 2 == 0 && hres % 2 == 0);
     
     /* first we need to figure out how far away the points the rays intersect the screen at are */
     float woffsetLength = scene->camera->width / (wres - 1); /* pixel offset length along width */
     float hoffsetLength = scene->camera->height / (hres - 1); /* pixel offset length along height */
 
     Vec3f_t cam_dir; /* the direction the camera is pointing */
-    Vec3f_t woffset, hoffset; /* vectors along offset direction */
 
     SubV3f(scene->camera->look_at, scene->camera->pos, cam_dir);
     NormalizeV3f(cam_dir);
 
     /* notice that this doesn't get messed up of up is not perpendicular to cam_dir */
-    CrossV3f(cam_dir, scene->camera->up, woffset);
-    CrossV3f(cam_dir, woffset, hoffset);
+    CrossV3f(cam_dir, scene->camera->up, job.woffset);
+    CrossV3f(cam_dir, job.woffset, job.hoffset);
 
-    NormalizeV3f(woffset);
-    NormalizeV3f(hoffset);
+    NormalizeV3f(job.woffset);
+    NormalizeV3f(job.hoffset);
 
-    ScaleV3f(woffsetLength, woffset, woffset);
-    ScaleV3f(hoffsetLength, hoffset, hoffset);
-
-    Rayf_t ray; /* the ray we'll shoot into the scene */
-    Vec3f_t screenPos; /* the position on the screen that the ray passes through */
+    ScaleV3f(woffsetLength, job.woffset, job.woffset);
+    ScaleV3f(hoffsetLength, job.hoffset, job.hoffset);
 
     /* Calculate an initial position in the screen */
-    Vec3f_t centerScreenPos; /* The position of the center of our screen */
-    ScaledAddV3f(scene->camera->pos, scene->camera->focal_length, cam_dir, centerScreenPos);
-
+    ScaledAddV3f(scene->camera->pos, scene->camera->focal_length, cam_dir, job.centerScreenPos);
 
-    for (i = 0; i < wres; i++) {
-	for (j = 0;j < hres; j++) {
-	    assert(wres % 2 == 0 && hres % 2 == 0);
+    /* packets can only go through a hierarchy, with a grid every ray is traced on its own */
+    job.packets = scene->settings->packets && scene->grid == NULL;
 
-	    /* setup the ray */
-	    CopyV3f(scene->camera->pos, ray.orig);
-	    ScaledAddV3f(centerScreenPos, i - (wres / 2), woffset, screenPos);
-	    ScaledAddV3f(screenPos, j - (hres / 2), hoffset, screenPos);
-	    SubV3f(screenPos, ray.orig, ray.dir);
-	    NormalizeV3f(ray.dir);
+    /* a cap below the base count just means every pixel gets the base count */
+    job.base = scene->settings->aa_base > 1 ? scene->settings->aa_base : 1;
+    job.max = scene->settings->aa_max > job.base ? scene->settings->aa_max : job.base;
+    job.strata = (int) sqrtf((float) job.base);
+    SET_PARAM(PARAM_AA_BASE, job.base);
+    SET_PARAM(PARAM_AA_MAX, job.max);
+    SET_PARAM(PARAM_AA_THRESHOLD, scene->settings->aa_threshold);
+    SET_PARAM(PARAM_AA_BUDGET, (double) job.max * wres * hres);
 
-	    Trace_Ray(ray, scene, render[i + (wres * j)], 10);
-	}
+    /* in row order a tile is a band of packet_width rows the width of the frame */
+    if (scene->settings->traversal == TRAVERSE_ROWS) {
+	job.tileW = wres;
+	job.tileH = packet_width;
+    } else {
+	job.tileW = job.tileH = render_tile_size;
     }
-    return render;
+    job.wTiles = (wres + job.tileW - 1) / job.tileW;
+    int hTiles = (hres + job.tileH - 1) / job.tileH;
+    job.wBlocks = (job.tileW + packet_width - 1) / packet_width;
+    job.nBlocks = job.wBlocks * ((job.tileH + packet_width - 1) / packet_width);
+    job.tileOrder = Curve_Order(scene->settings->traversal, job.wTiles, hTiles);
+    job.blockOrder = Curve_Order(scene->settings->traversal, job.wBlocks, job.nBlocks / job.wBlocks);
+
+    /* the frame is padded out to whole tiles */
+    size_t frameSize = (size_t) job.wTiles * hTiles * job.tileW * job.tileH;
+    job.render = NEWVEC(Colorf_t, frameSize);
+    memset(job.render, 0, sizeof(Colorf_t) * frameSize);
+
+    if (scene->pool == NULL)
+	scene->pool = New_Pool(scene->settings->nThreads);
+    job.pixels = job.max > 1 ? NEWVEC(Pixel_Samples_t, (size_t) scene->pool->nThreads * job.tileW * job.tileH) : NULL;
+    Run_Pool(scene->pool, job.wTiles * hTiles, Render_Tile, &job);
+
+    /* lay the frame out row by row for whoever gets it, a row of a tile at a time */
+    Colorf_t *frame = NEWVEC(Colorf_t, wres * hres);
+    for (j = 0; j < hres; j++)
+	for (i = 0; i < wres; i += job.tileW)
+	    memcpy(frame[i + wres * j], Frame_Pixel(&job, i, j), sizeof(Colorf_t) * (wres - i < job.tileW ? wres - i : job.tileW));
+
+    free(job.render);
+    free(job.tileOrder);
+    free(job.blockOrder);
+    free(job.pixels);
+    return frame;
 }
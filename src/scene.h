@@ -11,12 +11,65 @@
 #include "objects/geometry.h"
 #include "objects/light.h"
 #include "objects/camera.h"
+#include "objects/bvh.h"
+#include "objects/grid.h"
+#include "objects/packet.h"
+#include "objects/prims.h"
+#include "objects/photons.h"
+#include "objects/lighttree.h"
+#include "engine/pool.h"
+#include "engine/sampler.h"
+
+/*! the different acceleration structures rays can be traced through */
+typedef enum {
+    ACCEL_NONE = 0,	/*!< test every object */
+    ACCEL_BVH,		/*!< a bounding volume hierarchy */
+    ACCEL_GRID,		/*!< a uniform grid */
+    NUM_ACCELS
+} Accel_Type_t;
+
+/*! the ways radiosity can be calculated */
+typedef enum {
+    RADIOSITY_REX = 0,	/*!< light rays cascade through the scene and are caught in a rex on each object */
+    RADIOSITY_PHOTONS,	/*!< photons bounce through the scene and are gathered from a photon map */
+    NUM_RADIOSITY_MODES
+} Radiosity_Mode_t;
+
+/*! the ways the workers can share the rexes while calculating radiosity */
+typedef enum {
+    REX_ATOMIC = 0,	/*!< everyone adds into the same rexes with atomic operations */
+    REX_PARTIAL,	/*!< every worker gets rexes of their own which are summed at the end */
+    NUM_REX_ACCUMS
+} Rex_Accum_t;
+
+/*! the orders the pixels of a frame can be traced in */
+typedef enum {
+    TRAVERSE_ROWS = 0,	/*!< bands of packet_width rows top to bottom, each left to right */
+    TRAVERSE_TILES,	/*!< render_tile_size squares row by row, the packets in each row by row */
+    TRAVERSE_MORTON,	/*!< the squares, and the packets in each, along a Z-order curve */
+    TRAVERSE_HILBERT,	/*!< the squares, and the packets in each, along a Hilbert curve */
+    NUM_TRAVERSALS
+} Traversal_t;
 
 /*! \brief settings for a scene */
 typedef struct {
     Color_t		background;	/*!< the background color of the scene */
     char		radiosity;	/*!< whether or not to use radiosity */
     int			rad_accuracy;	/*!< how many rays to use in the radiosity calculation */
+    Radiosity_Mode_t	rad_mode;	/*!< how to calculate radiosity */
+    Accel_Type_t	accel;		/*!< which acceleration structure to use */
+    int			nThreads;	/*!< how many threads to render with, 0 for one per core */
+    uint64_t		seed;		/*!< the seed for all the random numbers in a run */
+    Rex_Accum_t		rex_accum;	/*!< how the workers share the rexes */
+    bool		packets;	/*!< whether to trace primary rays in packets */
+    int			light_samples;	/*!< how many lights to pick at each hit when there are more, 0 to always use every light */
+    float		ray_cutoff;	/*!< secondary rays adding less than this to a pixel aren't traced */
+    bool		roulette;	/*!< whether to play Russian roulette with those rays rather than drop them */
+    int			aa_base;	/*!< how many samples every pixel gets */
+    int			aa_max;		/*!< the most samples a pixel can get, 1 for a single ray through each center */
+    float		aa_threshold;	/*!< pixels whose luminance is likely further off than this get more samples */
+    Sampler_Type_t	sampler;	/*!< where light directions, bounce directions and sample positions come from */
+    Traversal_t		traversal;	/*!< the order pixels are traced in */
 } Settings_t;
 
 /*! \brief a scene */
@@ -27,6 +80,15 @@ typedef struct {
     Light_t		**light;	/*!< an array of light objects in the scene */
     Camera_t		*camera;	/*!< the camera in the scene */
     Settings_t		*settings;	/*!< global properties in the scene */
+    Pool_t		*pool;		/*!< the threads that work on the scene */
+    BVH_t		*bvh;		/*!< hierarchy over the bounded geometry, if the settings ask for one */
+    Grid_t		*grid;		/*!< grid over the bounded geometry, if the settings ask for one */
+    int			nUnbounded;	/*!< the number of geometry objects that don't fit in the acceleration structure */
+    Geometry_t		**unbounded;	/*!< geometry objects with no bounding box (planes) */
+    Prim_Table_t	*prims;		/*!< the objects tested one by one, laid out for the per type loops */
+    Prim_Runs_t		runs;		/*!< how many objects of each kind prims holds */
+    Photon_Map_t	*photons;	/*!< the photons, if radiosity was calculated with them */
+    Light_Tree_t	*lights;	/*!< tree over the lights, if there are more than settings->light_samples */
 } Scene_t;
 
 /* !New_Scene
@@ -34,34 +96,108 @@ typedef struct {
  */
 Scene_t *New_Scene(int nGeo, int nLights);
 
+/* !Delete_Scene
+ * \brief free a scene and everything in it, stopping its threads
+ */
+void Delete_Scene(Scene_t *scene);
+
+/* !Prepare_Scene
+ * \brief compute bounding boxes, build the acceleration structures and start the threads for a scene,
+ * should be called once all the geometry has been read in
+ */
+void Prepare_Scene(Scene_t *scene);
+
 /* !Intersect_Scene
  * \brief intersect a ray with an entire scene.
+ * \param dst where to write the closest intersection, only touched if there is a hit
+ * \return whether the ray hit anything
  */
-Intersection_t *Intersect_Scene(Rayf_t ray, Scene_t *scene);
+bool Intersect_Scene(Rayf_t ray, Scene_t *scene, Intersection_t *dst);
+
+/* !Occluded_Scene
+ * \brief whether anything in a scene is in the way of a ray before tmax, for shadow rays
+ * \param ray the ray
+ * \param scene the scene
+ * \param tmax only objects closer than this count, the distance to the light for a shadow ray
+ */
+bool Occluded_Scene(Rayf_t ray, Scene_t *scene, float tmax);
+
+/* !IntersectPacket_Scene
+ * \brief find which object each ray in a packet hits first
+ * \param packet the rays, their closest hits are written into it
+ * \param scene the scene, which must not be using a grid
+ */
+void IntersectPacket_Scene(Packet_t *packet, Scene_t *scene);
 
 /* !Trace_Ray
- * \brief shoots a ray into a scene and returns the color of the pixel
+ * \brief shoots a ray into a scene and returns the radiance it sees
+ * \param ray the ray
+ * \param scene the scene
+ * \param color where to write the radiance
+ * \param recursion how many more times the ray may be reflected
+ * \param weight how much of the radiance ends up in the pixel, 1 for a primary ray
+ *
+ * reflected and refracted rays whose weight falls below settings->ray_cutoff
+ * are dropped, or culled by Russian roulette if settings->roulette is set.
  */
-void Trace_Ray(Rayf_t ray, Scene_t *scene, Color_t color, int recursion);
+void Trace_Ray(Rayf_t ray, Scene_t *scene, Colorf_t color, int recursion, float weight);
 
 /* !Calculate_Rex
  * \brief Use monte-carlo technique to compute each surfaces illumination
  * \param scene the scene we're computing rexes for
  * \param resolution the resolution of the scene
  * \param accuracy how many rays to use in calculating the illumination
+ *
+ * the light rays are split into batches for the scene's pool. the workers
+ * either all add into the same rexes atomically or each get rexes of their
+ * own which are summed at the end, depending on the scene's settings. the
+ * rexes keep plain sums so both give the same answer.
+ */
+void Calculate_Rex(Scene_t *scene, int resolution, int accuracy);
+
+/* !Calculate_Photons
+ * \brief trace photons from every light and gather them into the scene's photon map
+ * \param scene the scene
+ * \param accuracy how many photons each light sends out
+ *
+ * each photon follows a single path, at every surface it hits it leaves
+ * behind the light that surface reflects diffusely and carries on with it
+ * in a random direction about the normal. Russian roulette stops the path
+ * with the chance that the light is absorbed, and scales up the photons
+ * that survive to make up for it.
  */
-void Caclulate_Rex(Scene_t *scene, int resolution, int accuracy);
+void Calculate_Photons(Scene_t *scene, int accuracy);
 
 #define rex_perturb 	0.95f	/*!< how much to jiggle the light ray when calculating rexs */		
 #define rex_recursion 	1	/*!< how many times to let the rex bounce */
 #define rex_cascade	100	/*!< how much the rays should cascade through the scene */
+#define rex_batch_size	256	/*!< how many light rays a worker throws at a time */
+
+#define light_samples_default	8		/*!< how many lights are picked at each hit unless the scene says otherwise */
+#define light_rng_stream	0x4c494748u	/*!< keeps the streams for picking lights apart from the others */
+#define ray_cutoff_default	0.002f		/*!< the weight below which secondary rays aren't traced unless the scene says otherwise */
+#define roulette_rng_stream	0x524f554cu	/*!< keeps the streams for Russian roulette apart from the others */
+
+#define render_tile_size 16	/*!< the side of the square tiles a frame is split into for the workers */
+#define aa_threshold_default	0.01f		/*!< the error in a pixel's luminance worth another sample unless the scene says otherwise */
+#define aa_rng_stream		0x41414141u	/*!< keeps the streams for placing samples in pixels apart from the others */
 
 /* !Render_Scene
- * \brief Shoots rays in to a scene to evaluate their color and returns them as an hres by vres array
+ * \brief Shoots rays in to a scene and returns the radiance they see as an hres by vres array
  * \param scene the scene to be rendered
  * \param wres width resolution (should be a power of 2)
  * \param hres height resolution (should be a power of 2)
+ *
+ * the frame is cut into tiles which the scene's pool works through, idle
+ * workers steal tiles from busy ones so expensive regions get shared out.
+ * samples are summed into the frame in floating point, nothing is rounded
+ * to 8 bits until the frame goes through Tonemap_Image.
+ *
+ * with settings->aa_max above 1 each pixel gets settings->aa_base samples
+ * spread over a grid in the pixel, then more one at a time while the
+ * standard error of its luminance is above settings->aa_threshold, up to
+ * aa_max. flat regions stop at the base count and edges get the rest.
  */
-Color_t *Render_Scene(Scene_t *scene, int wres, int hres);
+Colorf_t *Render_Scene(Scene_t *scene, int wres, int hres);
 
 #endif